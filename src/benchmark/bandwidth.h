@@ -9,6 +9,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// Divides the amount of data moved by every test, for shorter runs.
+#ifndef BANDWIDTH_DIVISOR
+#define BANDWIDTH_DIVISOR 1
+#endif
+
 const double GB = 1024 * 1024 * 1024;
 const size_t SIZE = 4 * 1024 * 1024;
 const size_t M = 1000000;
@@ -111,40 +116,40 @@ static void read_from_queue(struct spsc_queue *q,
 static void writer(struct spsc_queue *q)
 {
   printf("Starting homogenous test. (read_size == write_size).\n");
-  write_to_queue(q, (10 * M) * (10 * KB), 10 * KB, 0);
+  write_to_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 10 * KB, 0);
 
   usleep(1000 * 100);
   printf("Starting inhomogenous test (read_size > write_size).\n");
-  write_to_queue(q, (10 * M) * (10 * KB), 10 * KB, 0);
+  write_to_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 10 * KB, 0);
 
   usleep(1000 * 100);
   printf("Starting inhomogenous test (read_size < write_size).\n");
-  write_to_queue(q, (1 * M) * (100 * KB), 100 * KB, 0);
+  write_to_queue(q, (1 * M / BANDWIDTH_DIVISOR) * (100 * KB), 100 * KB, 0);
 
   usleep(1000 * 100);
   printf("Starting homogenous random test. (read_size ~ write_size).\n");
-  write_to_queue(q, (10 * M) * (10 * KB), 9 * KB, 2 * KB);
+  write_to_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 9 * KB, 2 * KB);
 
   usleep(1000 * 100);
   printf("Starting inhomogenous random test (read_size ~> write_size).\n");
-  write_to_queue(q, (10 * M) * (10 * KB), 9 * KB, 2 * KB);
+  write_to_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 9 * KB, 2 * KB);
 
   usleep(1000 * 100);
   printf("Starting inhomogenous random test (read_size ~< write_size).\n");
-  write_to_queue(q, (1 * M) * (100 * KB), 90 * KB, 20 * KB);
+  write_to_queue(q, (1 * M / BANDWIDTH_DIVISOR) * (100 * KB), 90 * KB, 20 * KB);
 }
 
 static void reader(struct spsc_queue *q)
 {
-  read_from_queue(q, (10 * M) * (10 * KB), 10 * KB, 0);
+  read_from_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 10 * KB, 0);
 
-  read_from_queue(q, (1 * M) * (100 * KB), 100 * KB, 0);
+  read_from_queue(q, (1 * M / BANDWIDTH_DIVISOR) * (100 * KB), 100 * KB, 0);
 
-  read_from_queue(q, (10 * M) * (10 * KB), 10 * KB, 0);
+  read_from_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 10 * KB, 0);
 
-  read_from_queue(q, (10 * M) * (10 * KB), 9 * KB, 2 * KB);
+  read_from_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 9 * KB, 2 * KB);
 
-  read_from_queue(q, (1 * M) * (100 * KB), 90 * KB, 20 * KB);
+  read_from_queue(q, (1 * M / BANDWIDTH_DIVISOR) * (100 * KB), 90 * KB, 20 * KB);
 
-  read_from_queue(q, (10 * M) * (10 * KB), 9 * KB, 2 * KB);
+  read_from_queue(q, (10 * M / BANDWIDTH_DIVISOR) * (10 * KB), 9 * KB, 2 * KB);
 }
@@ -1,4 +1,4 @@
-#include <spsc_queue.h>
+#include <spsc_umwait.h>
 
 #include <errno.h>
 #include <stdint.h>
@@ -7,9 +7,18 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/wait.h>
 
 static const size_t SIZE = 4 * 1024;
 static const size_t OPS = 10000;
+static const char *RAPL_ENERGY = "/sys/class/powercap/intel-rapl:0/energy_uj";
+
+enum wait_mode
+{
+  WAIT_FUTEX,
+  WAIT_SPIN,
+  WAIT_UMWAIT,
+};
 
 void parent(struct spsc_queue *q)
 {
@@ -22,7 +31,7 @@ void parent(struct spsc_queue *q)
     struct timespec now;
 
     clock_gettime(CLOCK_MONOTONIC, &now);
-    
+
     spsc_queue_write_from(q, &now, sizeof(now));
 
     usleep(100);
@@ -41,31 +50,82 @@ int cmp(const void *a, const void *b)
   return (t1 < t2) ? -1 : 1;
 }
 
-void child(struct spsc_queue *q)
+// Package energy in microjoules, or 0 if RAPL is not available.
+static uint64_t energy_uj()
+{
+  FILE *f = fopen(RAPL_ENERGY, "r");
+  unsigned long long energy = 0;
+
+  if (f)
+  {
+    if (fscanf(f, "%llu", &energy) != 1)
+      energy = 0;
+    fclose(f);
+  }
+
+  return energy;
+}
+
+static double seconds(clockid_t clock)
+{
+  struct timespec now;
+
+  clock_gettime(clock, &now);
+
+  return now.tv_sec + now.tv_nsec * 1E-9;
+}
+
+static const void *wait_read(struct spsc_queue *q, size_t size, enum wait_mode mode)
+{
+  switch (mode)
+  {
+  case WAIT_SPIN:
+    return spsc_queue_read_spin(q, size, ~0U);
+  case WAIT_UMWAIT:
+    // Long enough to cover the writer's pauses.
+    return spsc_queue_read_umwait(q, size, 100 * 1000 * 1000, SPSC_UMWAIT_C01);
+  default:
+    return spsc_queue_read(q, size);
+  }
+}
+
+void child(struct spsc_queue *q, enum wait_mode mode)
 {
   size_t data[OPS];
+  double wall = seconds(CLOCK_MONOTONIC);
+  double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+  uint64_t energy = energy_uj();
 
   for (size_t i = 0; i < OPS; i++)
   {
     struct timespec now, ptime;
 
-    spsc_queue_read_to(q, &ptime, sizeof(ptime));
+    memcpy(&ptime, wait_read(q, sizeof(ptime), mode), sizeof(ptime));
+    spsc_queue_read_commit(q, sizeof(ptime));
 
     clock_gettime(CLOCK_MONOTONIC, &now);
 
     data[i] = 1000 * 1000 * 1000 * (now.tv_sec - ptime.tv_sec) + (now.tv_nsec - ptime.tv_nsec);
   }
 
+  wall = seconds(CLOCK_MONOTONIC) - wall;
+  cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
   qsort(data, OPS, sizeof(size_t), cmp);
 
   printf("Reader done.\n");
-  printf("min: %lu ns, median: %lu ns, max: %lu ns\n",
-         data[0], data[OPS/2], data[OPS-1]);
+  printf("min: %lu ns, median: %lu ns, 99%%: %lu ns, max: %lu ns\n",
+         data[0], data[OPS/2], data[OPS * 99 / 100], data[OPS-1]);
+  printf("reader cpu time: %.1f%% of %.2f s", 100 * cpu / wall, wall);
+  if (energy)
+    printf(", package energy: %.2f J", (energy_uj() - energy) * 1E-6);
+  printf("\n");
 }
 
-int main(int argc, const char **argv)
+static int run(enum wait_mode mode)
 {
   struct spsc_queue q;
+  pid_t pid;
 
   spsc_queue_init(&q);
 
@@ -75,16 +135,38 @@ int main(int argc, const char **argv)
     return 1;
   }
 
-  if (fork())
+  // The writer flushes its output, which must not include ours.
+  fflush(stdout);
+
+  pid = fork();
+
+  if (pid)
   {
-    child(&q);
+    child(&q, mode);
+    waitpid(pid, NULL, 0);
   }
   else
   {
     parent(&q);
+    fflush(stdout);
+    _exit(0);
   }
 
   spsc_queue_free(&q);
 
   return 0;
 }
+
+int main(int argc, const char **argv)
+{
+  printf("Wait mode: futex\n");
+  if (run(WAIT_FUTEX))
+    return 1;
+
+  printf("Wait mode: pause spin\n");
+  if (run(WAIT_SPIN))
+    return 1;
+
+  printf("Wait mode: umwait%s\n", spsc_umwait_supported() ? "" : " (not supported, falls back to pause spin)");
+  return run(WAIT_UMWAIT);
+}
@@ -0,0 +1,151 @@
+#include <spsc_channel.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static const size_t SIZE = 64 * 1024;
+static const size_t OPS = 100000;
+static const size_t PIPELINE = 32;
+
+struct request
+{
+  uint64_t value;
+};
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return 1000 * 1000 * 1000 * (uint64_t)now.tv_sec + now.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+  uint64_t t1 = *(uint64_t*)a;
+  uint64_t t2 = *(uint64_t*)b;
+
+  if (t1 == t2) return 0;
+
+  return (t1 < t2) ? -1 : 1;
+}
+
+// Echoes requests until it receives an empty one.
+static void server(struct spsc_channel *ch)
+{
+  while (1)
+  {
+    struct request req;
+    uint64_t id;
+    size_t size = spsc_channel_recv_request(ch, &id, &req, sizeof(req));
+
+    if (!size)
+      break;
+
+    req.value++;
+    spsc_channel_send_response(ch, id, &req, sizeof(req));
+  }
+}
+
+static void round_trip(struct spsc_channel *ch, const char *name)
+{
+  uint64_t *data = malloc(OPS * sizeof(uint64_t));
+
+  assert(data);
+
+  for (size_t i = 0; i < OPS; i++)
+  {
+    struct request req = { i };
+    struct request resp;
+    uint64_t start = now_ns();
+
+    spsc_channel_call(ch, &req, sizeof(req), &resp, sizeof(resp));
+
+    data[i] = now_ns() - start;
+
+    assert(resp.value == i + 1);
+  }
+
+  qsort(data, OPS, sizeof(uint64_t), cmp);
+
+  printf("%s round trip: min: %lu ns, median: %lu ns, 99%%: %lu ns, max: %lu ns\n", name,
+         (unsigned long)data[0], (unsigned long)data[OPS/2], (unsigned long)data[OPS * 99 / 100],
+         (unsigned long)data[OPS-1]);
+
+  free(data);
+}
+
+static void pipelined(struct spsc_channel *ch, const char *name)
+{
+  uint64_t start = now_ns();
+
+  for (size_t i = 0; i < OPS; i += PIPELINE)
+  {
+    for (size_t j = 0; j < PIPELINE; j++)
+    {
+      struct request req = { i + j };
+      spsc_channel_send_request(ch, &req, sizeof(req));
+    }
+
+    for (size_t j = 0; j < PIPELINE; j++)
+    {
+      struct request resp;
+      uint64_t id;
+      spsc_channel_recv_response(ch, &id, &resp, sizeof(resp));
+    }
+  }
+
+  printf("%s pipelined (%zu outstanding): %lu ns per call\n", name, PIPELINE,
+         (unsigned long)((now_ns() - start) / OPS));
+}
+
+static int run(unsigned int spins, const char *name)
+{
+  struct spsc_channel ch;
+  pid_t pid;
+
+  spsc_channel_init(&ch);
+
+  if (spsc_channel_alloc_anonymous(&ch, SIZE))
+  {
+    printf("Creating spsc channel failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ch.spins = spins;
+
+  pid = fork();
+
+  if (!pid)
+  {
+    server(&ch);
+    _exit(0);
+  }
+
+  usleep(10000);
+
+  round_trip(&ch, name);
+  pipelined(&ch, name);
+
+  spsc_channel_send_request(&ch, NULL, 0);
+  waitpid(pid, NULL, 0);
+
+  spsc_channel_free(&ch);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (run(0, "futex"))
+    return 1;
+
+  return run(SPSC_CHANNEL_DEFAULT_SPINS, "spin");
+}
@@ -0,0 +1,131 @@
+#define SPSC_TRACE
+
+#include <spsc_trace.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static const size_t SIZE = 64 * 1024;
+static const size_t OPS = 20000;
+static const size_t BURST = 64;
+static const size_t LOOP_OPS = 10 * 1000 * 1000;
+
+struct message
+{
+  uint64_t value[4];
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Sends bursts of messages, which queue up behind a slow reader.
+static void writer(struct spsc_queue *q)
+{
+  struct message m = { { 0 } };
+
+  for (size_t i = 0; i < OPS; i++)
+  {
+    m.value[0] = i;
+    spsc_trace_write_from(q, &m, sizeof(m));
+
+    if (i % BURST == BURST - 1)
+      usleep(1000);
+  }
+}
+
+static void reader(struct spsc_queue *q, struct spsc_trace_histogram *h)
+{
+  struct message m;
+
+  for (size_t i = 0; i < OPS; i++)
+  {
+    spsc_trace_read_to(q, h, &m, sizeof(m));
+    assert(m.value[0] == i);
+
+    // Processing takes about 5 us per message.
+    uint64_t end = spsc_trace_ticks() + (uint64_t)(5000 / h->ns_per_tick);
+
+    while (spsc_trace_ticks() < end)
+      sq_cpu_relax();
+  }
+}
+
+// Cost of stamping and recording, measured in one thread.
+static void overhead(struct spsc_queue *q, struct spsc_trace_histogram *h)
+{
+  struct message m = { { 0 } };
+  struct timespec start;
+  double plain, traced;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < LOOP_OPS; i++)
+  {
+    spsc_queue_write_from(q, &m, sizeof(m));
+    spsc_queue_read_to(q, &m, sizeof(m));
+  }
+  plain = elapsed_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < LOOP_OPS; i++)
+  {
+    spsc_trace_write_from(q, &m, sizeof(m));
+    spsc_trace_read_to(q, h, &m, sizeof(m));
+  }
+  traced = elapsed_since(&start);
+
+  printf("Overhead: %.1f ns per record (%.1f ns plain, %.1f ns traced)\n",
+         (traced - plain) * 1E9 / LOOP_OPS, plain * 1E9 / LOOP_OPS, traced * 1E9 / LOOP_OPS);
+}
+
+int main(int argc, const char **argv)
+{
+  struct spsc_queue q;
+  struct spsc_trace_histogram *h = spsc_trace_alloc_anonymous();
+  pid_t pid;
+
+  spsc_queue_init(&q);
+
+  if (h == MAP_FAILED || spsc_queue_alloc_anonymous(&q, SIZE))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  spsc_trace_calibrate(h, 50);
+  printf("%.3f ns per tick\n", h->ns_per_tick);
+
+  pid = fork();
+
+  if (!pid)
+  {
+    writer(&q);
+    _exit(0);
+  }
+
+  reader(&q, h);
+  waitpid(pid, NULL, 0);
+
+  printf("Time in queue of %llu messages: mean: %.0f ns, median: %.0f ns, 99%%: %.0f ns, max: %.0f ns\n",
+         (unsigned long long)spsc_trace_count(h), spsc_trace_mean(h), spsc_trace_percentile(h, 50),
+         spsc_trace_percentile(h, 99), sq_read_once(h->max) * h->ns_per_tick);
+
+  spsc_trace_reset(h);
+  overhead(&q, h);
+
+  spsc_queue_free(&q);
+  spsc_trace_free(h);
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <spsc_queue.hpp>
+#include <spsc_basic_queue.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+struct message {
+  float foo[127];
+};
+
+static const size_t SIZE = 4 * 1024 * 1024;
+static const int OPS = 4 * 1000 * 1000;
+
+template <typename Queue>
+void writer(Queue &q)
+{
+  message m;
+
+  memset(&m, 0, sizeof(m));
+
+  for (int i = 0; i < OPS; i++) {
+    q.write(m);
+  }
+}
+
+template <typename Queue>
+void reader(Queue &q)
+{
+  for (int i = 0; i < OPS; i++) {
+    auto m = q.template read<message>();
+    (void)m;
+  }
+}
+
+template <typename Queue>
+void run(const char *name, Queue &q)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread t1(writer<Queue>, std::ref(q));
+  std::thread t2(reader<Queue>, std::ref(q));
+
+  t1.join();
+  t2.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf("%-40s %lf s, %lf GB/s\n", name, elapsed.count(),
+         (double)OPS * sizeof(message) / elapsed.count() / (1024.0 * 1024 * 1024));
+}
+
+int main(int argc, const char **argv)
+{
+  {
+    spsc::queue q(SIZE);
+    run("spsc::queue", q);
+  }
+  {
+    spsc::basic_queue<uint32_t, spsc::futex_wait, spsc::no_stats, spsc::memcpy_copy, SIZE> q;
+    run("basic_queue<uint32_t, futex, SIZE>", q);
+  }
+  {
+    spsc::basic_queue<uint64_t, spsc::futex_wait, spsc::no_stats, spsc::memcpy_copy, SIZE> q;
+    run("basic_queue<uint64_t, futex, SIZE>", q);
+  }
+  {
+    spsc::basic_queue<uint32_t, spsc::eventfd_wait, spsc::no_stats, spsc::memcpy_copy, SIZE> q;
+    run("basic_queue<uint32_t, eventfd, SIZE>", q);
+  }
+  {
+    spsc::basic_queue<uint32_t, spsc::spin_wait, spsc::no_stats, spsc::memcpy_copy, SIZE> q;
+    run("basic_queue<uint32_t, spin, SIZE>", q);
+  }
+  {
+    spsc::basic_queue<uint32_t, spsc::futex_wait, spsc::counting_stats, spsc::memcpy_copy, SIZE> q;
+    run("basic_queue<uint32_t, futex, stats, SIZE>", q);
+  }
+  {
+    spsc::basic_queue<uint32_t, spsc::futex_wait, spsc::no_stats, spsc::movsb_copy, SIZE> q;
+    run("basic_queue<uint32_t, futex, movsb, SIZE>", q);
+  }
+
+  return 0;
+}
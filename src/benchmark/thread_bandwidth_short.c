@@ -0,0 +1,5 @@
+// thread_bandwidth with a twentieth of the data, for make bench.
+#define BANDWIDTH_DIVISOR 20
+
+#include "bandwidth.h"
+#include "thread.h"
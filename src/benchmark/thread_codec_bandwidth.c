@@ -0,0 +1,174 @@
+#include <spsc_codec.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t SIZE = 4 * 1024 * 1024;
+const size_t RECORDS = 256;
+const size_t TOTAL = (size_t)1024 * 1024 * 1024;
+
+struct test
+{
+  const char *name;
+  uint32_t codecs;
+  size_t record_size;
+  int random;
+};
+
+struct context
+{
+  struct spsc_codec_queue q;
+  const struct test *test;
+  unsigned char *records;
+  size_t encoded;
+};
+
+static inline size_t minimum(size_t a, size_t b)
+{
+  return a < b ? a : b;
+}
+
+// Records in the style of JSON metrics, with a few changing digits.
+static void fill_records(unsigned char *records, size_t record_size, int random)
+{
+  unsigned int seed = 42;
+
+  for (size_t i = 0; i < RECORDS; i++)
+  {
+    unsigned char *dst = records + i * record_size;
+    size_t pos = 0;
+
+    if (random)
+    {
+      for (pos = 0; pos < record_size; pos++)
+        dst[pos] = (unsigned char)rand_r(&seed);
+      continue;
+    }
+
+    while (pos < record_size)
+    {
+      char line[128];
+      int n = snprintf(line, sizeof(line),
+                       "{\"host\":\"web-%02u\",\"metric\":\"requests\",\"value\":%u,\"ts\":%u}\n",
+                       (unsigned)(i % 16), rand_r(&seed) % 1000, 1600000000u + (unsigned)i);
+      size_t len = minimum((size_t)n, record_size - pos);
+
+      memcpy(dst + pos, line, len);
+      pos += len;
+    }
+  }
+}
+
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  size_t record_size = ctx->test->record_size;
+  size_t encoded = 0;
+
+  for (size_t i = 0; i < TOTAL; i += record_size)
+  {
+    encoded += spsc_codec_write_from(&ctx->q, ctx->records + ((i / record_size) % RECORDS) * record_size,
+                                     record_size);
+  }
+
+  ctx->encoded = encoded;
+
+  return NULL;
+}
+
+static int run(const struct test *test)
+{
+  struct context ctx;
+  struct spsc_codec_queue reader;
+  struct timespec start;
+  struct timespec finish;
+  pthread_t t;
+  unsigned char *buf = malloc(test->record_size);
+
+  ctx.test = test;
+  ctx.records = malloc(RECORDS * test->record_size);
+  assert(buf && ctx.records);
+  fill_records(ctx.records, test->record_size, test->random);
+
+  spsc_codec_init(&ctx.q);
+
+  if (spsc_codec_alloc_anonymous(&ctx.q, SIZE))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  spsc_codec_setup(&ctx.q, test->codecs, SPSC_CODEC_LZ4_THRESHOLD);
+
+  spsc_codec_init(&reader);
+  reader.q = ctx.q.q;
+  reader.meta = ctx.q.meta;
+  spsc_codec_attach(&reader, ~0u);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_create(&t, NULL, writer, &ctx);
+
+  size_t errors = 0;
+
+  for (size_t i = 0; i < TOTAL; i += test->record_size)
+  {
+    size_t size = spsc_codec_read_to(&reader, buf, test->record_size);
+    const unsigned char *expected = ctx.records + ((i / test->record_size) % RECORDS) * test->record_size;
+
+    if (unlikely(size != test->record_size || memcmp(buf, expected, size)))
+      errors++;
+  }
+
+  pthread_join(t, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  double elapsed = finish.tv_sec - start.tv_sec + (finish.tv_nsec - start.tv_nsec) * 1E-9;
+
+  printf("%-32s %lf s, %lf GB/s logical, %lf GB/s in ring, ratio %.3f\n",
+         test->name, elapsed, TOTAL / elapsed / GB, ctx.encoded / elapsed / GB,
+         (double)ctx.encoded / TOTAL);
+
+  spsc_codec_free(&ctx.q);
+  free(ctx.records);
+  free(buf);
+
+  if (errors)
+  {
+    printf("%s: %zu records did not decode to what was written\n", test->name, errors);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  const uint32_t LZ4 = 1u << SPSC_CODEC_LZ4;
+  const uint32_t DELTA = 1u << SPSC_CODEC_DELTA;
+  const struct test tests[] = {
+    { "json 16 KB raw",        0,     16 * 1024, 0 },
+    { "json 16 KB lz4",        LZ4,   16 * 1024, 0 },
+    { "random 16 KB raw",      0,     16 * 1024, 1 },
+    { "random 16 KB lz4",      LZ4,   16 * 1024, 1 },
+    { "json 128 B raw",        0,     128,       0 },
+    { "json 128 B delta",      DELTA, 128,       0 },
+    { "random 128 B raw",      0,     128,       1 },
+    { "random 128 B delta",    DELTA, 128,       1 },
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+  {
+    if (run(&tests[i]))
+      return 1;
+  }
+
+  return 0;
+}
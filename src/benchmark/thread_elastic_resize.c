@@ -0,0 +1,174 @@
+#include <spsc_elastic.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t KB = 1024;
+const size_t MB = 1024 * 1024;
+const size_t MIN_SIZE = 64 * 1024;
+const size_t MAX_SIZE = 64 * 1024 * 1024;
+const size_t RECORD = 4 * 1024;
+// Written before the reader starts, to make the ring grow.
+const size_t BURST = 32 * 1024 * 1024;
+// Written while the reader keeps up.
+const size_t STREAM = (size_t)4 * 1024 * 1024 * 1024;
+// Record size which ends the reader.
+const size_t END = 8;
+
+struct context
+{
+  struct spsc_elastic_queue reader;
+  size_t expected;
+  size_t errors;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Every record starts with its sequence number, which is checked here.
+static void *reader(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char *buf = malloc(RECORD);
+
+  assert(buf);
+
+  while (1)
+  {
+    uint64_t seq;
+    size_t size = spsc_elastic_read_to(&ctx->reader, buf, RECORD);
+
+    if (size == (size_t)-1)
+    {
+      ctx->errors++;
+      break;
+    }
+
+    if (size == END)
+      break;
+
+    memcpy(&seq, buf, sizeof(seq));
+
+    if (unlikely(size != RECORD || seq != ctx->expected))
+      ctx->errors++;
+
+    ctx->expected++;
+  }
+
+  free(buf);
+
+  return NULL;
+}
+
+static int write_records(struct spsc_elastic_queue *q, char *buf, uint64_t *seq, size_t bytes)
+{
+  for (size_t i = 0; i < bytes; i += RECORD)
+  {
+    memcpy(buf, seq, sizeof(*seq));
+    (*seq)++;
+
+    if (spsc_elastic_write_from(q, buf, RECORD))
+      return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  struct spsc_elastic_queue writer;
+  struct context ctx;
+  struct timespec start;
+  pthread_t thread;
+  char name[64];
+  char *buf = calloc(1, RECORD);
+  uint64_t seq = 0;
+  int status = 1;
+
+  assert(buf);
+
+  snprintf(name, sizeof(name), "/spsc_elastic_bench.%d", (int)getpid());
+
+  spsc_elastic_init(&writer);
+  spsc_elastic_init(&ctx.reader);
+  ctx.expected = 0;
+  ctx.errors = 0;
+
+  if (spsc_elastic_create(&writer, name, MIN_SIZE, MIN_SIZE, MAX_SIZE) ||
+      spsc_elastic_open_reader(&ctx.reader, name))
+  {
+    printf("Creating elastic queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  do
+  {
+    // The ring grows to hold the whole burst.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (write_records(&writer, buf, &seq, BURST))
+      break;
+
+    printf("Burst of %zu MiB written in %lf s, capacity %zu KiB\n", BURST / MB, elapsed_since(&start),
+           spsc_elastic_capacity(&writer) / KB);
+
+    pthread_create(&thread, NULL, reader, &ctx);
+
+    // The queue goes quiet once the reader has drained the burst, and
+    // only maintenance shrinks the ring.
+    while (sq_read_once(writer.ring.header->read_offset) != sq_read_once(writer.ring.header->write_offset))
+      usleep(1000);
+
+    unsigned int calls = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (spsc_elastic_capacity(&writer) > MIN_SIZE)
+    {
+      spsc_elastic_maintain(&writer);
+      calls++;
+    }
+
+    printf("Idle ring shrunk to %zu KiB in %lf s, %u maintenance calls\n",
+           spsc_elastic_capacity(&writer) / KB, elapsed_since(&start), calls);
+
+    // Streaming through the small ring.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (write_records(&writer, buf, &seq, STREAM))
+      break;
+
+    if (spsc_elastic_write_from(&writer, buf, END))
+      break;
+
+    pthread_join(thread, NULL);
+
+    printf("Streaming: %lf GB/s, capacity %zu KiB, %zu errors\n", STREAM / elapsed_since(&start) / GB,
+           spsc_elastic_capacity(&writer) / KB, ctx.errors);
+
+    status = ctx.errors || ctx.expected != seq ? 1 : 0;
+  }
+  while (0);
+
+  if (status)
+    printf("Elastic queue failed\n");
+
+  spsc_elastic_unlink(&writer);
+  spsc_elastic_free(&ctx.reader);
+  spsc_elastic_free(&writer);
+  free(buf);
+
+  return status;
+}
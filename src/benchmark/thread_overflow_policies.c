@@ -0,0 +1,187 @@
+#include <spsc_overflow.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const size_t RING_SIZE = 64 * 1024;
+const size_t SPILL_SIZE = 1024 * 1024;
+const size_t RECORDS = 1000 * 1000;
+const size_t RECORD = 64;
+// Both sides pause after a batch of records, so that they take turns even
+// on one CPU. The reader pauses for longer, so that the ring overflows.
+const size_t WRITER_BATCH = 4096;
+const useconds_t WRITER_PAUSE_US = 50;
+const size_t READER_BATCH = 1024;
+const useconds_t READER_PAUSE_US = 100;
+
+struct context
+{
+  struct spsc_overflow_queue q;
+  SQ_ATOMIC(int) done;
+  size_t received;
+  size_t errors;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Record i starts with i and is filled with its low byte, so that a torn
+// copy shows up as a mismatch.
+static void fill_record(char *buf, uint64_t i)
+{
+  memset(buf, (int)(i & 0xff), RECORD);
+  memcpy(buf, &i, sizeof(i));
+}
+
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char buf[RECORD];
+
+  for (uint64_t i = 0; i < RECORDS; i++)
+  {
+    fill_record(buf, i);
+    spsc_overflow_write_from(&ctx->q, buf, RECORD);
+
+    if ((i + 1) % WRITER_BATCH == 0)
+      usleep(WRITER_PAUSE_US);
+  }
+
+  sq_thread_fence_release();
+  sq_store_once(ctx->done, 1);
+
+  return NULL;
+}
+
+// Records may be missing, but the ones which arrive have to be intact and
+// in order.
+static void reader(struct context *ctx)
+{
+  char buf[RECORD], expected[RECORD];
+  uint64_t last = 0;
+
+  while (1)
+  {
+    int done = sq_read_once(ctx->done);
+    size_t size;
+    uint64_t i;
+
+    sq_thread_fence_acquire();
+
+    if (!spsc_overflow_try_read_to(&ctx->q, buf, sizeof(buf), &size))
+    {
+      if (done)
+        break;
+
+      continue;
+    }
+
+    memcpy(&i, buf, sizeof(i));
+    fill_record(expected, i);
+
+    if (unlikely(size != RECORD || memcmp(buf, expected, RECORD) || (ctx->received && i <= last)))
+      ctx->errors++;
+
+    last = i;
+
+    if (++ctx->received % READER_BATCH == 0)
+      usleep(READER_PAUSE_US);
+  }
+}
+
+// Every record is either read or counted as dropped by the writer, and
+// the reader finds the records missing before the last one it read.
+static int run(enum spsc_overflow_policy policy, const char *name)
+{
+  struct context ctx;
+  struct timespec start;
+  pthread_t thread;
+  char spill_template[] = "/tmp/spsc_overflow.XXXXXX";
+
+  spsc_overflow_init(&ctx.q, policy);
+  sq_store_once(ctx.done, 0);
+  ctx.received = 0;
+  ctx.errors = 0;
+
+  if (spsc_overflow_alloc_anonymous(&ctx.q, RING_SIZE) ||
+      (policy == SPSC_OVERFLOW_SPILL && spsc_overflow_spill_create(&ctx.q, SPILL_SIZE, spill_template)))
+  {
+    printf("Creating overflow queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, writer, &ctx);
+  reader(&ctx);
+  pthread_join(thread, NULL);
+
+  double elapsed = elapsed_since(&start);
+
+  if (ctx.received + ctx.q.dropped != RECORDS || ctx.q.lost > ctx.q.dropped ||
+      ctx.received + ctx.q.lost != ctx.q.read_seq)
+    ctx.errors++;
+
+  printf("%s: %lf M records/s, %zu read, %llu dropped, %llu lost, %zu errors\n", name,
+         RECORDS / elapsed * 1E-6, ctx.received, (unsigned long long)ctx.q.dropped,
+         (unsigned long long)ctx.q.lost, ctx.errors);
+
+  spsc_overflow_free(&ctx.q);
+
+  return ctx.errors ? 1 : 0;
+}
+
+// A record which can never fit is dropped rather than waited for.
+static int run_block_oversized()
+{
+  struct spsc_overflow_queue q;
+  char *big = calloc(1, RING_SIZE);
+  char buf[RECORD];
+  uint64_t i = 1;
+  size_t size = 0;
+  int errors = 0;
+
+  assert(big);
+  spsc_overflow_init(&q, SPSC_OVERFLOW_BLOCK);
+
+  if (spsc_overflow_alloc_anonymous(&q, RING_SIZE))
+  {
+    printf("Creating overflow queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  errors += spsc_overflow_write_from(&q, big, RING_SIZE) != 0;
+  fill_record(buf, i);
+  errors += spsc_overflow_write_from(&q, buf, RECORD) != 1;
+  errors += !spsc_overflow_try_read_to(&q, buf, sizeof(buf), &size);
+  errors += size != RECORD || memcmp(buf, &i, sizeof(i)) || q.dropped != 1 || q.lost != 1;
+
+  printf("Block, oversized record: %llu dropped, %d errors\n", (unsigned long long)q.dropped, errors);
+
+  spsc_overflow_free(&q);
+  free(big);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  int status = 0;
+
+  status |= run(SPSC_OVERFLOW_DROP_NEWEST, "Drop newest");
+  status |= run(SPSC_OVERFLOW_OVERWRITE_OLDEST, "Overwrite oldest");
+  status |= run(SPSC_OVERFLOW_SPILL, "Spill");
+  status |= run_block_oversized();
+
+  return status;
+}
@@ -0,0 +1,146 @@
+#include <spsc_pipeline.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t SIZE = 1024 * 1024;
+const size_t RECORDS = 10 * 1000 * 1000;
+
+// A record holds its sequence number and one field for each stage, which
+// that stage fills in place.
+#define MAX_STAGES 7
+
+struct record
+{
+  uint64_t seq;
+  uint64_t fields[MAX_STAGES];
+};
+
+struct stage_context
+{
+  struct spsc_pipeline *p;
+  unsigned int stage;
+  size_t errors;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+static uint64_t field_value(uint64_t seq, unsigned int stage)
+{
+  return seq * 31 + stage;
+}
+
+// Checks the sequence number and the fields of the stages before this
+// one, then fills in its own.
+static void *stage(void *arg)
+{
+  struct stage_context *ctx = (struct stage_context*)arg;
+
+  for (uint64_t i = 0; i < RECORDS; i++)
+  {
+    struct record *r = (struct record*)spsc_pipeline_stage(ctx->p, ctx->stage, sizeof(*r));
+    int bad = r->seq != i;
+
+    for (unsigned int k = 1; k < ctx->stage; k++)
+      bad |= r->fields[k - 1] != field_value(i, k);
+
+    for (unsigned int k = ctx->stage; k <= MAX_STAGES; k++)
+      bad |= r->fields[k - 1] != 0;
+
+    r->fields[ctx->stage - 1] = field_value(i, ctx->stage);
+    ctx->errors += bad;
+
+    spsc_pipeline_stage_commit(ctx->p, ctx->stage, sizeof(*r));
+  }
+
+  return NULL;
+}
+
+static int run(unsigned int stages)
+{
+  struct spsc_pipeline p;
+  struct stage_context ctx[MAX_STAGES];
+  pthread_t threads[MAX_STAGES];
+  struct timespec start;
+  size_t errors = 0;
+
+  spsc_pipeline_init(&p);
+
+  if (spsc_pipeline_alloc_anonymous(&p, SIZE, stages))
+  {
+    printf("Creating pipeline failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (unsigned int k = 0; k < stages; k++)
+  {
+    ctx[k].p = &p;
+    ctx[k].stage = k + 1;
+    ctx[k].errors = 0;
+    pthread_create(&threads[k], NULL, stage, &ctx[k]);
+  }
+
+  // The writer gets each slot back after the last stage, and checks that
+  // every stage has filled in its field of the record from one lap ago.
+  const uint64_t slots = SIZE / sizeof(struct record);
+
+  for (uint64_t i = 0; i < RECORDS; i++)
+  {
+    struct record *r = (struct record*)spsc_pipeline_write(&p, sizeof(*r));
+
+    if (i >= slots)
+    {
+      int bad = r->seq != i - slots;
+
+      for (unsigned int k = 1; k <= stages; k++)
+        bad |= r->fields[k - 1] != field_value(i - slots, k);
+
+      errors += bad;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->seq = i;
+    spsc_pipeline_write_commit(&p, sizeof(*r));
+  }
+
+  for (unsigned int k = 0; k < stages; k++)
+  {
+    pthread_join(threads[k], NULL);
+    errors += ctx[k].errors;
+  }
+
+  double elapsed = elapsed_since(&start);
+
+  printf("%u stage%s: %lf M records/s, %lf GB/s, %zu errors\n", stages, stages > 1 ? "s" : " ",
+         RECORDS / elapsed * 1E-6, RECORDS * sizeof(struct record) / elapsed / GB, errors);
+
+  spsc_pipeline_free(&p);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  int status = 0;
+
+  status |= run(1);
+  status |= run(2);
+  status |= run(4);
+
+  return status;
+}
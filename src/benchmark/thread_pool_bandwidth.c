@@ -0,0 +1,174 @@
+#include <spsc_pool.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t KB = 1024;
+const size_t MB = 1024 * 1024;
+const size_t TOTAL = (size_t)4 * 1024 * 1024 * 1024;
+// Each path may have this many frames in flight.
+const uint32_t FRAMES = 4;
+
+struct context
+{
+  struct spsc_queue q;
+  struct spsc_pool pool;
+  size_t frame_size;
+  char *buf;
+};
+
+static size_t ring_size(size_t frame_size)
+{
+  size_t size = (size_t)getpagesize();
+
+  while (size < FRAMES * frame_size)
+    size *= 2;
+
+  return size;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// The producer fills every frame, then it is copied into the ring and out
+// again.
+static void *copy_writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+
+  for (size_t i = 0; i < TOTAL; i += ctx->frame_size)
+  {
+    memset(ctx->buf, (int)(i / ctx->frame_size), ctx->frame_size);
+    spsc_queue_write_from(&ctx->q, ctx->buf, ctx->frame_size);
+  }
+
+  return NULL;
+}
+
+static size_t copy_reader(struct context *ctx, char *dst)
+{
+  size_t sum = 0;
+
+  for (size_t i = 0; i < TOTAL; i += ctx->frame_size)
+  {
+    spsc_queue_read_to(&ctx->q, dst, ctx->frame_size);
+    sum += (unsigned char)dst[ctx->frame_size - 1];
+  }
+
+  return sum;
+}
+
+// The producer fills every frame in a pool buffer, which the reader uses
+// in place.
+static void *pool_writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+
+  for (size_t i = 0; i < TOTAL; i += ctx->frame_size)
+  {
+    uint32_t index;
+    void *dst = spsc_pool_acquire(&ctx->pool, &index);
+
+    memset(dst, (int)(i / ctx->frame_size), ctx->frame_size);
+    spsc_pool_send(&ctx->q, &ctx->pool, index, ctx->frame_size);
+  }
+
+  return NULL;
+}
+
+static size_t pool_reader(struct context *ctx)
+{
+  size_t sum = 0;
+
+  for (size_t i = 0; i < TOTAL; i += ctx->frame_size)
+  {
+    struct spsc_pool_desc desc;
+    const char *src = (const char*)spsc_pool_receive(&ctx->q, &ctx->pool, &desc);
+
+    sum += (unsigned char)src[desc.length - 1];
+    spsc_pool_release(&ctx->pool, &desc);
+  }
+
+  return sum;
+}
+
+static int run(size_t frame_size)
+{
+  struct context ctx;
+  struct timespec start;
+  pthread_t t;
+  char *dst = malloc(frame_size);
+  size_t sum;
+  double elapsed;
+
+  ctx.frame_size = frame_size;
+  ctx.buf = malloc(frame_size);
+  assert(dst && ctx.buf);
+
+  spsc_queue_init(&ctx.q);
+
+  if (spsc_queue_alloc_anonymous(&ctx.q, ring_size(frame_size)))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&t, NULL, copy_writer, &ctx);
+  sum = copy_reader(&ctx, dst);
+  pthread_join(t, NULL);
+  elapsed = elapsed_since(&start);
+
+  printf("%8zu KB copy: %lf s, %lf GB/s (%zu)\n", frame_size / KB, elapsed, TOTAL / elapsed / GB, sum);
+
+  spsc_queue_free(&ctx.q);
+  spsc_queue_init(&ctx.q);
+  spsc_pool_init(&ctx.pool);
+
+  if (spsc_queue_alloc_anonymous(&ctx.q, (size_t)getpagesize()) ||
+      spsc_pool_alloc_anonymous(&ctx.pool, 1, frame_size, FRAMES))
+  {
+    printf("Creating buffer pool failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&t, NULL, pool_writer, &ctx);
+  sum = pool_reader(&ctx);
+  pthread_join(t, NULL);
+  elapsed = elapsed_since(&start);
+
+  printf("%8zu KB pool: %lf s, %lf GB/s (%zu)\n", frame_size / KB, elapsed, TOTAL / elapsed / GB, sum);
+
+  spsc_pool_free(&ctx.pool);
+  spsc_queue_free(&ctx.q);
+  free(ctx.buf);
+  free(dst);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  const size_t sizes[] = { 100 * KB, 1 * MB, 4 * MB, 16 * MB };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    if (run(sizes[i]))
+      return 1;
+  }
+
+  return 0;
+}
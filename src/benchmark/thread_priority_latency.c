@@ -0,0 +1,177 @@
+#include <spsc_priority.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const size_t KB = 1024;
+const size_t CONTROL_SIZE = 4 * 1024;
+const size_t BULK_SIZE = 4 * 1024 * 1024;
+const size_t BULK_RECORD = 64 * 1024;
+const size_t CONTROL_OPS = 2000;
+// A control message is sent every this many microseconds.
+const uint64_t CONTROL_INTERVAL_NS = 200 * 1000;
+
+enum message_type
+{
+  MESSAGE_CONTROL,
+  MESSAGE_BULK,
+  MESSAGE_END,
+};
+
+struct message
+{
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sent;
+};
+
+struct context
+{
+  struct spsc_priority p;
+  int lanes;
+  char *bulk;
+  uint64_t *latencies;
+};
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return 1000 * 1000 * 1000 * (uint64_t)now.tv_sec + now.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+  uint64_t t1 = *(uint64_t*)a;
+  uint64_t t2 = *(uint64_t*)b;
+
+  if (t1 == t2) return 0;
+
+  return (t1 < t2) ? -1 : 1;
+}
+
+// Keeps the bulk lane full and sends a control message at a fixed
+// interval. With a single lane control messages queue up behind bulk data.
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  unsigned int bulk_lane = ctx->lanes - 1;
+  uint64_t next = now_ns();
+  size_t sent = 0;
+
+  while (sent < CONTROL_OPS)
+  {
+    uint64_t now = now_ns();
+
+    if (now >= next)
+    {
+      struct message m = { MESSAGE_CONTROL, 0, now };
+
+      spsc_priority_write_from(&ctx->p, 0, &m, sizeof(m));
+      next += CONTROL_INTERVAL_NS;
+      sent++;
+      continue;
+    }
+
+    struct message *m = (struct message*)ctx->bulk;
+
+    m->type = MESSAGE_BULK;
+
+    if (!spsc_priority_try_write_from(&ctx->p, bulk_lane, ctx->bulk, BULK_RECORD))
+      sched_yield();
+  }
+
+  struct message end = { MESSAGE_END, 0, 0 };
+
+  spsc_priority_write_from(&ctx->p, bulk_lane, &end, sizeof(end));
+
+  return NULL;
+}
+
+// Processing bulk data is slow, control messages are answered at once.
+static void reader(struct context *ctx)
+{
+  char *buf = malloc(BULK_RECORD);
+  size_t received = 0;
+  uint64_t sum = 0;
+
+  assert(buf);
+
+  while (1)
+  {
+    unsigned int lane;
+    size_t size = spsc_priority_read_to(&ctx->p, &lane, buf, BULK_RECORD);
+    struct message m;
+
+    assert(size >= sizeof(m));
+    memcpy(&m, buf, sizeof(m));
+
+    if (m.type == MESSAGE_END)
+      break;
+
+    if (m.type == MESSAGE_CONTROL)
+    {
+      ctx->latencies[received++] = now_ns() - m.sent;
+      continue;
+    }
+
+    for (size_t i = 0; i < size; i++)
+      sum = sum * 31 + (unsigned char)buf[i];
+  }
+
+  qsort(ctx->latencies, received, sizeof(uint64_t), cmp);
+
+  printf("%d lane%s: control latency min: %lu ns, median: %lu ns, 99%%: %lu ns, max: %lu ns (%lu)\n",
+         ctx->lanes, ctx->lanes > 1 ? "s" : "", (unsigned long)ctx->latencies[0],
+         (unsigned long)ctx->latencies[received / 2], (unsigned long)ctx->latencies[received * 99 / 100],
+         (unsigned long)ctx->latencies[received - 1], (unsigned long)(sum & 1));
+
+  free(buf);
+}
+
+static int run(int lanes)
+{
+  struct context ctx;
+  // With one lane, control messages share the bulk ring.
+  size_t sizes[2] = { lanes > 1 ? CONTROL_SIZE : BULK_SIZE, BULK_SIZE };
+  pthread_t thread;
+
+  spsc_priority_init(&ctx.p);
+
+  if (spsc_priority_alloc_anonymous(&ctx.p, (unsigned int)lanes, sizes))
+  {
+    printf("Creating priority queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ctx.lanes = lanes;
+  ctx.bulk = calloc(1, BULK_RECORD);
+  ctx.latencies = malloc(CONTROL_OPS * sizeof(uint64_t));
+  assert(ctx.bulk && ctx.latencies);
+
+  pthread_create(&thread, NULL, writer, &ctx);
+  reader(&ctx);
+  pthread_join(thread, NULL);
+
+  spsc_priority_free(&ctx.p);
+  free(ctx.latencies);
+  free(ctx.bulk);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (run(1))
+    return 1;
+
+  return run(2);
+}
@@ -0,0 +1,131 @@
+#include <spsc_queue_pool.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const size_t KB = 1024;
+const size_t MB = 1024 * 1024;
+const size_t OPS = 20000;
+const size_t THREADS = 4;
+
+struct context
+{
+  size_t size;
+  int flags;
+  int pooled;
+  size_t ops;
+  size_t failures;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Creates a queue, passes one message through it and frees it again.
+static void *create_free(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  struct spsc_queue_pool pool;
+  uint64_t value = 0;
+
+  spsc_queue_pool_init(&pool);
+
+  if (ctx->pooled && (spsc_queue_pool_setup(&pool, ctx->size, 16, ctx->flags) ||
+                      spsc_queue_pool_reserve(&pool, 16)))
+  {
+    ctx->failures = ctx->ops;
+    return NULL;
+  }
+
+  for (size_t i = 0; i < ctx->ops; i++)
+  {
+    struct spsc_queue q;
+    int status;
+
+    if (ctx->pooled)
+    {
+      status = spsc_queue_pool_get(&pool, &q);
+    }
+    else
+    {
+      spsc_queue_init(&q);
+      status = spsc_queue_alloc_anonymous_flags(&q, ctx->size, ctx->flags);
+    }
+
+    if (status)
+    {
+      ctx->failures++;
+      continue;
+    }
+
+    spsc_queue_write_from(&q, &i, sizeof(i));
+    spsc_queue_read_to(&q, &value, sizeof(value));
+    assert(value == i);
+
+    if (ctx->pooled)
+      spsc_queue_pool_put(&pool, &q);
+    else
+      spsc_queue_free(&q);
+  }
+
+  spsc_queue_pool_free(&pool);
+
+  return NULL;
+}
+
+static void run(size_t size, int flags, int pooled, const char *name)
+{
+  struct context ctx[THREADS];
+  pthread_t threads[THREADS];
+  struct timespec start;
+  size_t failures = 0;
+  // Populating faults in the whole ring, which takes much longer.
+  size_t ops = (flags & SPSC_QUEUE_POPULATE) ? OPS / 50 : OPS;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < THREADS; i++)
+  {
+    ctx[i].size = size;
+    ctx[i].flags = flags;
+    ctx[i].pooled = pooled;
+    ctx[i].ops = ops;
+    ctx[i].failures = 0;
+    pthread_create(&threads[i], NULL, create_free, &ctx[i]);
+  }
+
+  for (size_t i = 0; i < THREADS; i++)
+  {
+    pthread_join(threads[i], NULL);
+    failures += ctx[i].failures;
+  }
+
+  double elapsed = elapsed_since(&start);
+
+  printf("%6zu KiB %-18s %zu threads: %.0f queues/s, %.2f us per create and free, %zu failures\n",
+         size / KB, name, THREADS, THREADS * ops / elapsed, elapsed * 1E6 / ops, failures);
+}
+
+int main(int argc, const char **argv)
+{
+  size_t sizes[] = { 64 * KB, 4 * MB };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    run(sizes[i], 0, 0, "mmap");
+    run(sizes[i], SPSC_QUEUE_POPULATE, 0, "mmap, populate");
+    run(sizes[i], 0, 1, "pool");
+  }
+
+  return 0;
+}
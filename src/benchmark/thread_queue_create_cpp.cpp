@@ -0,0 +1,68 @@
+#include <spsc_queue.hpp>
+#include <spsc_queue_pool.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+static const size_t KB = 1024;
+static const size_t OPS = 20000;
+
+// Creates a queue, passes one message through it and frees it again, with
+// a spsc::queue per iteration or with a queue from a pool.
+template <typename Func>
+static int run(size_t size, const char *name, Func &&once)
+{
+  size_t failures = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < OPS; i++)
+    failures += once(i) ? 0 : 1;
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf("%6zu KiB %-10s %.0f queues/s, %.2f us per create and free, %zu failures\n",
+         size / KB, name, OPS / elapsed.count(), elapsed.count() * 1E6 / OPS, failures);
+
+  return failures ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  const size_t size = 64 * KB;
+  struct spsc_queue_pool pool;
+  int status = 0;
+
+  status |= run(size, "spsc::queue", [&](size_t i) {
+    std::unique_ptr<spsc::queue> q(new spsc::queue(size));
+
+    q->write(i);
+    return q->read<size_t>() == i;
+  });
+
+  spsc_queue_pool_init(&pool);
+
+  if (spsc_queue_pool_setup(&pool, size, 16, 0) || spsc_queue_pool_reserve(&pool, 16))
+  {
+    printf("Setting up the pool failed\n");
+    return 1;
+  }
+
+  status |= run(size, "pool", [&](size_t i) {
+    struct spsc_queue q;
+    size_t value = 0;
+
+    if (spsc_queue_pool_get(&pool, &q))
+      return false;
+
+    spsc_queue_write_from(&q, &i, sizeof(i));
+    spsc_queue_read_to(&q, &value, sizeof(value));
+    spsc_queue_pool_put(&pool, &q);
+
+    return value == i;
+  });
+
+  spsc_queue_pool_free(&pool);
+
+  return status;
+}
@@ -0,0 +1,148 @@
+#include <spsc_waitv.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const size_t SIZE = 4 * 1024;
+const unsigned int QUEUES = 16;
+const size_t OPS = 10000;
+
+struct context
+{
+  struct spsc_queue *queues[SPSC_WAITV_MAX];
+  unsigned int count;
+  uint64_t *latencies;
+};
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return 1000 * 1000 * 1000 * (uint64_t)now.tv_sec + now.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+  uint64_t t1 = *(uint64_t*)a;
+  uint64_t t2 = *(uint64_t*)b;
+
+  if (t1 == t2) return 0;
+
+  return (t1 < t2) ? -1 : 1;
+}
+
+// Sends a timestamp to the queues in turn, pausing long enough for the
+// reader to fall asleep.
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+
+  usleep(10000);
+
+  for (size_t i = 0; i < OPS; i++)
+  {
+    uint64_t now = now_ns();
+
+    spsc_queue_write_from(ctx->queues[i % ctx->count], &now, sizeof(now));
+    usleep(100);
+  }
+
+  return NULL;
+}
+
+static void reader(struct context *ctx)
+{
+  unsigned int ready[SPSC_WAITV_MAX];
+  size_t received = 0;
+
+  while (received < OPS)
+  {
+    unsigned int n;
+
+    if (ctx->count == 1)
+    {
+      spsc_queue_read(ctx->queues[0], sizeof(uint64_t));
+      ready[0] = 0;
+      n = 1;
+    }
+    else
+    {
+      n = spsc_queue_read_any(ctx->queues, ctx->count, sizeof(uint64_t), ready);
+    }
+
+    uint64_t now = now_ns();
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+      uint64_t sent;
+
+      while (spsc_queue_try_read_to(ctx->queues[ready[i]], &sent, sizeof(sent)))
+        ctx->latencies[received++] = now - sent;
+    }
+  }
+}
+
+static int run(unsigned int count, const char *name)
+{
+  struct context ctx;
+  struct spsc_queue *queues = calloc(count, sizeof(struct spsc_queue));
+  pthread_t thread;
+
+  assert(queues);
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    spsc_queue_init(&queues[i]);
+
+    if (spsc_queue_alloc_anonymous(&queues[i], SIZE))
+    {
+      printf("Creating spsc queue failed: %s\n", strerror(errno));
+      return 1;
+    }
+
+    ctx.queues[i] = &queues[i];
+  }
+
+  ctx.count = count;
+  ctx.latencies = malloc(OPS * sizeof(uint64_t));
+  assert(ctx.latencies);
+
+  pthread_create(&thread, NULL, writer, &ctx);
+  reader(&ctx);
+  pthread_join(thread, NULL);
+
+  qsort(ctx.latencies, OPS, sizeof(uint64_t), cmp);
+
+  printf("%s: min: %lu ns, median: %lu ns, 99%%: %lu ns, max: %lu ns\n", name,
+         (unsigned long)ctx.latencies[0], (unsigned long)ctx.latencies[OPS / 2],
+         (unsigned long)ctx.latencies[OPS * 99 / 100], (unsigned long)ctx.latencies[OPS - 1]);
+
+  for (unsigned int i = 0; i < count; i++)
+    spsc_queue_free(&queues[i]);
+
+  free(ctx.latencies);
+  free(queues);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  char name[64];
+
+  if (run(1, "One queue, futex_wait"))
+    return 1;
+
+  snprintf(name, sizeof(name), "%u queues, %s", QUEUES,
+           spsc_waitv_supported() ? "futex_waitv" : "polling (no futex_waitv)");
+
+  return run(QUEUES, name);
+}
@@ -0,0 +1,152 @@
+#include <spsc_reclaim.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t KB = 1024;
+const size_t MB = 1024 * 1024;
+const size_t QUEUES = 64;
+const size_t SIZE = 4 * 1024 * 1024;
+const size_t MESSAGE = 16 * 1024;
+const size_t TOTAL = (size_t)8 * 1024 * 1024 * 1024;
+
+// Shared memory resident in this process, in bytes.
+static size_t rss_shmem()
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  size_t kb = 0;
+
+  if (!f)
+    return 0;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "RssShmem: %zu kB", &kb) == 1)
+      break;
+  }
+
+  fclose(f);
+
+  return kb * KB;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Fills every ring once and drains it again, then lets each writer run
+// its maintenance call twice.
+static int idle_queues()
+{
+  struct spsc_queue *queues = calloc(QUEUES, sizeof(struct spsc_queue));
+  struct spsc_reclaim *reclaim = calloc(QUEUES, sizeof(struct spsc_reclaim));
+  char *buf = calloc(1, MESSAGE);
+  size_t released = 0;
+
+  assert(queues && reclaim && buf);
+
+  for (size_t i = 0; i < QUEUES; i++)
+  {
+    spsc_queue_init(&queues[i]);
+
+    if (spsc_queue_alloc_anonymous(&queues[i], SIZE))
+    {
+      printf("Creating spsc queue failed: %s\n", strerror(errno));
+      return 1;
+    }
+
+    spsc_reclaim_init(&reclaim[i], 0, 64 * KB);
+
+    for (size_t j = 0; j < SIZE; j += MESSAGE)
+    {
+      memset(buf, (int)j, MESSAGE);
+      spsc_queue_write_from(&queues[i], buf, MESSAGE);
+      spsc_queue_read_to(&queues[i], buf, MESSAGE);
+    }
+  }
+
+  size_t before = rss_shmem();
+
+  for (size_t round = 0; round < 2; round++)
+  {
+    for (size_t i = 0; i < QUEUES; i++)
+      released += spsc_queue_reclaim(&queues[i], &reclaim[i]);
+  }
+
+  size_t after = rss_shmem();
+
+  printf("%zu idle queues of %zu MiB: RssShmem %zu MiB before, %zu MiB after reclaim, %zu MiB released\n",
+         QUEUES, SIZE / MB, before / MB, after / MB, released / MB);
+
+  for (size_t i = 0; i < QUEUES; i++)
+    spsc_queue_free(&queues[i]);
+
+  free(buf);
+  free(reclaim);
+  free(queues);
+
+  return 0;
+}
+
+// A busy queue calls the maintenance function as often as an idle one
+// would. Nothing is reclaimed, so the bandwidth has to stay the same.
+static int busy_queue(size_t interval, const char *name)
+{
+  struct spsc_queue q;
+  struct spsc_reclaim reclaim;
+  struct timespec start;
+  char *buf = calloc(1, MESSAGE);
+  size_t released = 0;
+
+  assert(buf);
+
+  spsc_queue_init(&q);
+
+  if (spsc_queue_alloc_anonymous(&q, SIZE))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  spsc_reclaim_init(&reclaim, SIZE / 4, 64 * KB);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0, n = 0; i < TOTAL; i += MESSAGE, n++)
+  {
+    spsc_queue_write_from(&q, buf, MESSAGE);
+    spsc_queue_read_to(&q, buf, MESSAGE);
+
+    if (interval && n % interval == 0)
+      released += spsc_queue_reclaim(&q, &reclaim);
+  }
+
+  printf("Busy queue, %s: %lf GB/s, %zu bytes released\n", name, TOTAL / elapsed_since(&start) / GB, released);
+
+  spsc_queue_free(&q);
+  free(buf);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (idle_queues())
+    return 1;
+
+  if (busy_queue(0, "no reclaim"))
+    return 1;
+
+  return busy_queue(64, "reclaim every 64 writes");
+}
@@ -0,0 +1,212 @@
+#include <spsc_record.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t SIZE = 4 * 1024 * 1024;
+const size_t EVENTS = 20 * 1000 * 1000;
+const size_t MAX_EVENT = 1024;
+const size_t NAMES = 64;
+
+enum mode
+{
+  // Serialise into a buffer, then copy it into the ring.
+  MODE_STAGING,
+  // Build the record in the ring.
+  MODE_BUILDER,
+};
+
+struct context
+{
+  struct spsc_queue q;
+  enum mode mode;
+  char **names;
+  size_t bytes;
+  size_t errors;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// An event: id, timestamp, a name of varying length and a payload of up
+// to a few hundred bytes.
+static size_t build_event(struct spsc_record_builder *b, struct context *ctx, uint64_t i)
+{
+  static const char payload[512];
+  const char *name = ctx->names[i % NAMES];
+
+  spsc_record_put_u64(b, i);
+  spsc_record_put_u64(b, i * 1000);
+  spsc_record_put_string(b, name);
+  spsc_record_put_blob(b, payload, (i * 37) % sizeof(payload));
+
+  return b->used;
+}
+
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char *staging = malloc(MAX_EVENT);
+  size_t bytes = 0;
+
+  assert(staging);
+
+  for (uint64_t i = 0; i < EVENTS; i++)
+  {
+    struct spsc_record_builder b;
+
+    if (ctx->mode == MODE_BUILDER)
+    {
+      spsc_record_begin(&b, &ctx->q, MAX_EVENT);
+      bytes += build_event(&b, ctx, i);
+      spsc_record_commit(&b);
+      continue;
+    }
+
+    // The same encoding, into a buffer of its own.
+    b.q = NULL;
+    b.data = staging;
+    b.used = 0;
+    b.max = MAX_EVENT;
+    b.last = 0;
+    b.failed = 0;
+
+    size_t size = build_event(&b, ctx, i);
+    uint32_t length = (uint32_t)size;
+    char *dst = (char*)spsc_queue_write(&ctx->q, sizeof(length) + size);
+
+    memcpy(dst, &length, sizeof(length));
+    memcpy(dst + sizeof(length), staging, size);
+    spsc_queue_write_commit(&ctx->q, sizeof(length) + size);
+    bytes += size;
+  }
+
+  ctx->bytes = bytes;
+  free(staging);
+
+  return NULL;
+}
+
+// Parses event number i, adds its fields to *sum and returns 0 if it is
+// the event build_event() wrote.
+static int parse_event(struct spsc_record_view *v, uint64_t i, uint64_t *sum)
+{
+  uint64_t id, ts;
+  const void *name, *payload;
+  size_t name_size, payload_size;
+
+  if (spsc_record_get_u64(v, &id) || spsc_record_get_u64(v, &ts) ||
+      spsc_record_get_blob(v, &name, &name_size) || spsc_record_get_blob(v, &payload, &payload_size))
+    return -1;
+
+  *sum += id + ts + name_size + payload_size;
+
+  if (id != i || payload_size != (i * 37) % 512)
+    return -1;
+
+  return 0;
+}
+
+static uint64_t reader(struct context *ctx)
+{
+  char *staging = malloc(MAX_EVENT);
+  uint64_t sum = 0;
+
+  assert(staging);
+
+  ctx->errors = 0;
+
+  for (size_t i = 0; i < EVENTS; i++)
+  {
+    struct spsc_record_view v;
+
+    if (ctx->mode == MODE_BUILDER)
+    {
+      spsc_record_read(&ctx->q, &v);
+      ctx->errors += parse_event(&v, i, &sum) != 0;
+      spsc_record_read_commit(&ctx->q, &v);
+      continue;
+    }
+
+    uint32_t length;
+
+    spsc_queue_read_to(&ctx->q, &length, sizeof(length));
+    spsc_queue_read_to(&ctx->q, staging, length);
+
+    v.data = staging;
+    v.size = length;
+    v.pos = 0;
+    v.failed = 0;
+    ctx->errors += parse_event(&v, i, &sum) != 0;
+  }
+
+  free(staging);
+
+  return sum;
+}
+
+static int run(enum mode mode, const char *name, char **names)
+{
+  struct context ctx;
+  struct timespec start;
+  pthread_t thread;
+
+  spsc_queue_init(&ctx.q);
+
+  if (spsc_queue_alloc_anonymous(&ctx.q, SIZE))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ctx.mode = mode;
+  ctx.names = names;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, writer, &ctx);
+  uint64_t sum = reader(&ctx);
+  pthread_join(thread, NULL);
+
+  double elapsed = elapsed_since(&start);
+
+  printf("%s: %lf M events/s, %lf GB/s, %zu errors (%lu)\n", name, EVENTS / elapsed * 1E-6, ctx.bytes / elapsed / GB,
+         ctx.errors, (unsigned long)(sum & 1));
+
+  spsc_queue_free(&ctx.q);
+
+  return ctx.errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  char *names[NAMES];
+
+  for (size_t i = 0; i < NAMES; i++)
+  {
+    names[i] = malloc(64);
+    assert(names[i]);
+    snprintf(names[i], 64, "service-%zu.%.*s", i, (int)(i % 40), "requests.latency.histogram.bucket.upper");
+  }
+
+  if (run(MODE_STAGING, "Staging buffer", names))
+    return 1;
+
+  int status = run(MODE_BUILDER, "In-place builder", names);
+
+  for (size_t i = 0; i < NAMES; i++)
+    free(names[i]);
+
+  return status;
+}
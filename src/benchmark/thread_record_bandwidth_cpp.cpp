@@ -0,0 +1,91 @@
+#include <spsc_queue.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+static const size_t SIZE = 4 * 1024 * 1024;
+static const size_t EVENTS = 20 * 1000 * 1000;
+static const size_t MAX_EVENT = 1024;
+static const size_t MAX_NAME = 32;
+static const size_t PAYLOAD = 512;
+
+// The same events as thread_record_bandwidth, built with
+// queue::write_record(): id, timestamp, a name formatted straight into
+// the ring and a payload of up to a few hundred bytes.
+static void writer(spsc::queue &q, size_t *failures)
+{
+  static const char payload[PAYLOAD] = {};
+
+  for (uint64_t i = 0; i < EVENTS; i++)
+  {
+    bool ok = q.write_record(MAX_EVENT, [&](spsc::record_writer &w) {
+      w.put(i);
+      w.put(i * 1000);
+
+      // The name is formatted into the ring and the rest of its
+      // reservation given back.
+      char *name = static_cast<char*>(w.reserve(MAX_NAME));
+
+      if (name)
+      {
+        int n = snprintf(name, MAX_NAME, "event-%llu", (unsigned long long)(i % 64));
+
+        w.unreserve(MAX_NAME - n);
+      }
+
+      w.put_blob(payload, (i * 37) % PAYLOAD);
+    });
+
+    *failures += !ok;
+  }
+
+  // Too large for its maximum, commits nothing.
+  *failures += q.write_record(8, [](spsc::record_writer &w) { w.put(payload, sizeof(payload)); });
+}
+
+static size_t reader(spsc::queue &q, size_t *bytes)
+{
+  size_t errors = 0;
+
+  for (uint64_t i = 0; i < EVENTS; i++)
+  {
+    q.read_record([&](spsc::record_reader &r) {
+      uint64_t id = 0, ts = 0;
+      char expected[MAX_NAME];
+      const void *payload;
+      size_t payload_size;
+      int n = snprintf(expected, sizeof(expected), "event-%llu", (unsigned long long)(i % 64));
+      const void *name;
+
+      *bytes += r.size();
+
+      if (!r.get(id) || !r.get(ts) || !(name = r.next(n)) || !r.get_blob(payload, payload_size) ||
+          r.remaining() || id != i || ts != i * 1000 || memcmp(name, expected, n) ||
+          payload_size != (i * 37) % PAYLOAD)
+        errors++;
+    });
+  }
+
+  return errors;
+}
+
+int main(int argc, const char **argv)
+{
+  spsc::queue q(SIZE);
+  size_t failures = 0, bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread t(writer, std::ref(q), &failures);
+  size_t errors = reader(q, &bytes);
+  t.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf("write_record / read_record: %lf M events/s, %lf GB/s, %zu errors\n",
+         EVENTS / elapsed.count() * 1E-6, bytes / elapsed.count() / (1024.0 * 1024 * 1024),
+         errors + failures);
+
+  return errors || failures ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+#include <spsc_segmented.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const double GB = 1024 * 1024 * 1024;
+const size_t KB = 1024;
+const size_t MB = 1024 * 1024;
+const size_t SEGMENT = 1024 * 1024;
+const uint32_t MAX_SEGMENTS = 1024;
+const size_t MESSAGE = 4 * 1024;
+const size_t TOTAL = (size_t)4 * 1024 * 1024 * 1024;
+// Written before the reader starts, to make the queue grow.
+const size_t BURST = 256 * 1024 * 1024;
+
+struct context
+{
+  struct spsc_segmented q;
+  size_t total;
+};
+
+// Shared memory resident in this process, in bytes.
+static size_t rss_shmem()
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  size_t kb = 0;
+
+  if (!f)
+    return 0;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "RssShmem: %zu kB", &kb) == 1)
+      break;
+  }
+
+  fclose(f);
+
+  return kb * KB;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+// Every message starts with its sequence number, which the reader checks
+// to catch messages lost or repeated when following a link.
+static void *segmented_writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char *buf = calloc(1, MESSAGE);
+
+  assert(buf);
+
+  for (size_t i = 0; i < ctx->total; i += MESSAGE)
+  {
+    uint64_t seq = i / MESSAGE;
+
+    memcpy(buf, &seq, sizeof(seq));
+    spsc_segmented_write_from(&ctx->q, buf, MESSAGE);
+  }
+
+  free(buf);
+
+  return NULL;
+}
+
+// Reads total bytes of messages and returns the number of messages which
+// were out of sequence.
+static size_t segmented_read(struct spsc_segmented *q, char *buf, size_t total)
+{
+  size_t errors = 0;
+
+  for (size_t i = 0; i < total; i += MESSAGE)
+  {
+    uint64_t seq;
+
+    spsc_segmented_read_to(q, buf, MESSAGE);
+    memcpy(&seq, buf, sizeof(seq));
+
+    if (unlikely(seq != i / MESSAGE))
+      errors++;
+  }
+
+  return errors;
+}
+
+static void *plain_writer(void *arg)
+{
+  struct spsc_queue *q = (struct spsc_queue*)arg;
+  char *buf = calloc(1, MESSAGE);
+
+  assert(buf);
+
+  for (size_t i = 0; i < TOTAL; i += MESSAGE)
+    spsc_queue_write_from(q, buf, MESSAGE);
+
+  free(buf);
+
+  return NULL;
+}
+
+// Baseline: a plain queue of one segment's size.
+static int plain()
+{
+  struct spsc_queue q;
+  struct timespec start;
+  pthread_t thread;
+  char *buf = calloc(1, MESSAGE);
+
+  assert(buf);
+
+  spsc_queue_init(&q);
+
+  if (spsc_queue_alloc_anonymous(&q, SEGMENT))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, plain_writer, &q);
+
+  for (size_t i = 0; i < TOTAL; i += MESSAGE)
+    spsc_queue_read_to(&q, buf, MESSAGE);
+
+  pthread_join(thread, NULL);
+
+  printf("Plain queue: %lf GB/s\n", TOTAL / elapsed_since(&start) / GB);
+
+  spsc_queue_free(&q);
+  free(buf);
+
+  return 0;
+}
+
+// Streams through the segmented queue. With a cap of one segment it
+// behaves like the plain queue, except for the space kept for the link.
+static int streaming(uint32_t cap)
+{
+  struct context ctx;
+  struct timespec start;
+  pthread_t thread;
+  char *buf = calloc(1, MESSAGE);
+
+  assert(buf);
+
+  spsc_segmented_init(&ctx.q);
+
+  if (spsc_segmented_alloc_anonymous(&ctx.q, SEGMENT, MAX_SEGMENTS, cap, 0))
+  {
+    printf("Creating segmented queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ctx.total = TOTAL;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, segmented_writer, &ctx);
+
+  size_t errors = segmented_read(&ctx.q, buf, TOTAL);
+
+  pthread_join(thread, NULL);
+
+  printf("Segmented queue, cap %u: %lf GB/s, %zu errors\n", cap, TOTAL / elapsed_since(&start) / GB, errors);
+
+  spsc_segmented_free(&ctx.q);
+  free(buf);
+
+  return errors ? 1 : 0;
+}
+
+// The writer runs ahead by BURST bytes without blocking, then the reader
+// drains the queue and the segments are released.
+static int burst()
+{
+  struct context ctx;
+  struct timespec start;
+  char *buf = calloc(1, MESSAGE);
+
+  assert(buf);
+
+  spsc_segmented_init(&ctx.q);
+
+  if (spsc_segmented_alloc_anonymous(&ctx.q, SEGMENT, MAX_SEGMENTS, 0, SPSC_SEGMENTED_RELEASE))
+  {
+    printf("Creating segmented queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ctx.total = BURST;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  segmented_writer(&ctx);
+  double written = elapsed_since(&start);
+
+  uint32_t peak = spsc_segmented_in_use(&ctx.q);
+  size_t grown = rss_shmem();
+
+  size_t errors = segmented_read(&ctx.q, buf, BURST);
+
+  printf("Burst of %zu MiB written in %lf s: %u segments, RssShmem %zu MiB, %zu MiB after draining, %zu errors\n",
+         BURST / MB, written, peak, grown / MB, rss_shmem() / MB, errors);
+
+  spsc_segmented_free(&ctx.q);
+  free(buf);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (plain())
+    return 1;
+
+  if (streaming(1))
+    return 1;
+
+  if (streaming(0))
+    return 1;
+
+  return burst();
+}
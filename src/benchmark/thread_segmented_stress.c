@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+
+// Lets the reader run while the writer is inside spsc_segmented_link(),
+// between publishing the link and committing it.
+#define SPSC_SEGMENTED_LINK_HOOK() sched_yield()
+
+#include <sched.h>
+
+#include <spsc_segmented.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Small segments and a cap of two, so that links are frequent and every
+// segment is recycled right after the reader leaves it.
+const size_t SEGMENT = 4096;
+const uint32_t MAX_SEGMENTS = 4;
+const uint32_t CAP = 2;
+const size_t MESSAGES = 1000 * 1000;
+const size_t MAX_MESSAGE = 256;
+
+struct context
+{
+  struct spsc_segmented q;
+};
+
+// Message i is 8 to MAX_MESSAGE bytes, a multiple of 8, and starts with
+// its sequence number.
+static size_t message_size(size_t i)
+{
+  return 8 + (i * 40) % (MAX_MESSAGE - 8) / 8 * 8;
+}
+
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char buf[MAX_MESSAGE];
+
+  memset(buf, 0xa5, sizeof(buf));
+
+  for (size_t i = 0; i < MESSAGES; i++)
+  {
+    uint64_t seq = i;
+
+    memcpy(buf, &seq, sizeof(seq));
+    spsc_segmented_write_from(&ctx->q, buf, message_size(i));
+  }
+
+  return NULL;
+}
+
+int main(int argc, const char **argv)
+{
+  struct context ctx;
+  struct timespec start, finish;
+  pthread_t thread;
+  char buf[MAX_MESSAGE];
+
+  spsc_segmented_init(&ctx.q);
+
+  if (spsc_segmented_alloc_anonymous(&ctx.q, SEGMENT, MAX_SEGMENTS, CAP, 0))
+  {
+    printf("Creating segmented queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, writer, &ctx);
+
+  for (size_t i = 0; i < MESSAGES; i++)
+  {
+    uint64_t seq;
+
+    spsc_segmented_read_to(&ctx.q, buf, message_size(i));
+    memcpy(&seq, buf, sizeof(seq));
+
+    // The stream is out of step after a mismatch, and the reader would
+    // end up waiting for bytes which never come.
+    if (unlikely(seq != i))
+    {
+      printf("Mismatch at %zu: got %llu\n", i, (unsigned long long)seq);
+      return 1;
+    }
+  }
+
+  pthread_join(thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  double elapsed = finish.tv_sec - start.tv_sec + (finish.tv_nsec - start.tv_nsec) * 1E-9;
+
+  printf("Yield inside every link: %lf M messages/s\n", MESSAGES / elapsed * 1E-6);
+
+  spsc_segmented_free(&ctx.q);
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include <spsc_sharded.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const size_t SIZE = 1024 * 1024;
+const size_t RECORDS = 4 * 1000 * 1000;
+const size_t KEYS = 4096;
+const size_t BATCH = 32;
+// The producer rebalances every this many records.
+const size_t REBALANCE_INTERVAL = 64 * 1024;
+const unsigned int MAX_CONSUMERS = 8;
+// Iterations of simulated work per record.
+const unsigned int WORK = 200;
+const uint64_t END = UINT64_MAX;
+
+struct record
+{
+  uint64_t seq;
+  uint64_t payload[6];
+};
+
+struct context
+{
+  struct spsc_sharded *s;
+  unsigned int lane;
+  // Last sequence number seen per key, shared by all consumers. A key is
+  // only ever processed by one consumer at a time.
+  uint64_t *last;
+  size_t count;
+  size_t errors;
+  uint64_t sink;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+static void *consumer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  struct spsc_sharded_record records[BATCH];
+
+  while (1)
+  {
+    size_t bytes;
+    size_t n = spsc_sharded_read_batch(ctx->s, ctx->lane, records, BATCH, &bytes);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      struct record r;
+
+      if (records[i].key == END)
+        return NULL;
+
+      memcpy(&r, records[i].data, sizeof(r));
+
+      if (r.seq <= ctx->last[records[i].key])
+        ctx->errors++;
+      ctx->last[records[i].key] = r.seq;
+
+      uint64_t h = r.payload[0];
+
+      for (unsigned int w = 0; w < WORK; w++)
+        h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+
+      ctx->sink += h;
+      ctx->count++;
+    }
+
+    spsc_sharded_read_commit(ctx->s, ctx->lane, bytes);
+  }
+}
+
+static int run(unsigned int consumers)
+{
+  struct spsc_sharded *s = malloc(sizeof(struct spsc_sharded));
+  uint64_t *seq = calloc(KEYS, sizeof(uint64_t));
+  uint64_t *last = calloc(KEYS, sizeof(uint64_t));
+  struct context ctx[MAX_CONSUMERS];
+  pthread_t threads[MAX_CONSUMERS];
+  struct spsc_sharded_record batch[BATCH];
+  struct record records[BATCH];
+  struct timespec start;
+  unsigned int seed = 1;
+  size_t count = 0;
+  size_t errors = 0;
+  int moves = 0;
+
+  assert(s && seq && last);
+
+  spsc_sharded_init(s);
+
+  if (spsc_sharded_alloc_anonymous(s, consumers, SIZE))
+  {
+    printf("Creating sharded queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < consumers; i++)
+  {
+    ctx[i].s = s;
+    ctx[i].lane = i;
+    ctx[i].last = last;
+    ctx[i].count = 0;
+    ctx[i].errors = 0;
+    ctx[i].sink = 0;
+    pthread_create(&threads[i], NULL, consumer, &ctx[i]);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < RECORDS; i += BATCH)
+  {
+    for (size_t j = 0; j < BATCH; j++)
+    {
+      // Skewed keys: half of the records use 1/16 of the keys.
+      uint64_t key = rand_r(&seed) % KEYS;
+
+      if (key & 1)
+        key = key % (KEYS / 16);
+
+      records[j].seq = ++seq[key];
+      records[j].payload[0] = key;
+      batch[j].key = key;
+      batch[j].data = &records[j];
+      batch[j].size = sizeof(records[j]);
+    }
+
+    spsc_sharded_write_batch(s, batch, BATCH);
+
+    if ((i + BATCH) % REBALANCE_INTERVAL < BATCH)
+      moves += spsc_sharded_rebalance(s, SIZE / 16);
+  }
+
+  spsc_sharded_broadcast(s, END, NULL, 0);
+
+  for (unsigned int i = 0; i < consumers; i++)
+  {
+    pthread_join(threads[i], NULL);
+    count += ctx[i].count;
+    errors += ctx[i].errors;
+  }
+
+  double elapsed = elapsed_since(&start);
+
+  printf("%u consumers: %.2f M records/s, %zu records, %d buckets moved, %zu order errors\n",
+         consumers, count / elapsed / 1E6, count, moves, errors);
+
+  spsc_sharded_free(s);
+  free(last);
+  free(seq);
+  free(s);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  unsigned int max = argc > 1 ? (unsigned int)atoi(argv[1]) : 4;
+
+  if (max < 1 || max > MAX_CONSUMERS)
+    max = 4;
+
+  for (unsigned int consumers = 1; consumers <= max; consumers++)
+  {
+    if (run(consumers))
+      return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+#include <spsc_queue.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const size_t SIZE = 4 * 1024 * 1024;
+const size_t RECORDS = 20 * 1000 * 1000;
+const size_t HEADER = 16;
+const size_t PAYLOAD = 64;
+const size_t TRAILER = 8;
+
+enum mode
+{
+  // One write_from() per fragment.
+  MODE_FRAGMENTS,
+  // One writev() per record.
+  MODE_WRITEV,
+};
+
+struct context
+{
+  struct spsc_queue q;
+  enum mode mode;
+};
+
+static double elapsed_since(const struct timespec *start)
+{
+  struct timespec finish;
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  return finish.tv_sec - start->tv_sec + (finish.tv_nsec - start->tv_nsec) * 1E-9;
+}
+
+static void *writer(void *arg)
+{
+  struct context *ctx = (struct context*)arg;
+  char header[HEADER], payload[PAYLOAD], trailer[TRAILER];
+  struct iovec iov[3] = {
+    { header, HEADER },
+    { payload, PAYLOAD },
+    { trailer, TRAILER },
+  };
+
+  memset(header, 1, HEADER);
+  memset(payload, 2, PAYLOAD);
+  memset(trailer, 3, TRAILER);
+
+  for (size_t i = 0; i < RECORDS; i++)
+  {
+    memcpy(header, &i, sizeof(i));
+
+    if (ctx->mode == MODE_WRITEV)
+    {
+      spsc_queue_writev(&ctx->q, iov, 3);
+      continue;
+    }
+
+    spsc_queue_write_from(&ctx->q, header, HEADER);
+    spsc_queue_write_from(&ctx->q, payload, PAYLOAD);
+    spsc_queue_write_from(&ctx->q, trailer, TRAILER);
+  }
+
+  return NULL;
+}
+
+static size_t reader(struct context *ctx)
+{
+  char header[HEADER], payload[PAYLOAD], trailer[TRAILER];
+  struct iovec iov[3] = {
+    { header, HEADER },
+    { payload, PAYLOAD },
+    { trailer, TRAILER },
+  };
+  size_t errors = 0;
+
+  for (size_t i = 0; i < RECORDS; i++)
+  {
+    if (ctx->mode == MODE_WRITEV)
+    {
+      spsc_queue_readv(&ctx->q, iov, 3);
+    }
+    else
+    {
+      spsc_queue_read_to(&ctx->q, header, HEADER);
+      spsc_queue_read_to(&ctx->q, payload, PAYLOAD);
+      spsc_queue_read_to(&ctx->q, trailer, TRAILER);
+    }
+
+    errors += memcmp(header, &i, sizeof(i)) != 0;
+  }
+
+  return errors;
+}
+
+static int run(enum mode mode, const char *name)
+{
+  struct context ctx;
+  struct timespec start;
+  pthread_t thread;
+
+  spsc_queue_init(&ctx.q);
+
+  if (spsc_queue_alloc_anonymous(&ctx.q, SIZE))
+  {
+    printf("Creating spsc queue failed: %s\n", strerror(errno));
+    return 1;
+  }
+
+  ctx.mode = mode;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&thread, NULL, writer, &ctx);
+  size_t errors = reader(&ctx);
+  pthread_join(thread, NULL);
+
+  double elapsed = elapsed_since(&start);
+
+  printf("%s: %lf M records/s, %zu errors\n", name, RECORDS / elapsed * 1E-6, errors);
+
+  spsc_queue_free(&ctx.q);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (run(MODE_FRAGMENTS, "Three writes per record"))
+    return 1;
+
+  return run(MODE_WRITEV, "One writev per record");
+}
@@ -0,0 +1,124 @@
+#include <spsc_queue.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static const size_t SIZE = 4 * 1024 * 1024;
+static const size_t RECORDS = 20 * 1000 * 1000;
+static const size_t HEADER = 16;
+static const size_t PAYLOAD = 64;
+static const size_t TRAILER = 8;
+
+enum mode
+{
+  // One write() per fragment.
+  MODE_FRAGMENTS,
+  // writev() and readv() with struct iovec arrays.
+  MODE_IOVEC,
+  // writev() with a list of std::string_view, readv() into a
+  // std::vector<std::vector<char>>.
+  MODE_RANGES,
+};
+
+static void writer(spsc::queue &q, mode m)
+{
+  char header[HEADER], payload[PAYLOAD], trailer[TRAILER];
+  struct iovec iov[3] = {
+    { header, HEADER },
+    { payload, PAYLOAD },
+    { trailer, TRAILER },
+  };
+
+  memset(header, 1, HEADER);
+  memset(payload, 2, PAYLOAD);
+  memset(trailer, 3, TRAILER);
+
+  for (size_t i = 0; i < RECORDS; i++)
+  {
+    memcpy(header, &i, sizeof(i));
+
+    switch (m)
+    {
+    case MODE_FRAGMENTS:
+      q.write(header, HEADER);
+      q.write(payload, PAYLOAD);
+      q.write(trailer, TRAILER);
+      break;
+    case MODE_IOVEC:
+      q.writev(iov, 3);
+      break;
+    case MODE_RANGES:
+      q.writev({ std::string_view(header, HEADER), std::string_view(payload, PAYLOAD),
+                 std::string_view(trailer, TRAILER) });
+      break;
+    }
+  }
+}
+
+static size_t reader(spsc::queue &q, mode m)
+{
+  std::vector<std::vector<char>> fields = {
+    std::vector<char>(HEADER), std::vector<char>(PAYLOAD), std::vector<char>(TRAILER)
+  };
+  std::array<struct iovec, 3> iov = {{
+    { fields[0].data(), HEADER },
+    { fields[1].data(), PAYLOAD },
+    { fields[2].data(), TRAILER },
+  }};
+  size_t errors = 0;
+
+  for (size_t i = 0; i < RECORDS; i++)
+  {
+    switch (m)
+    {
+    case MODE_FRAGMENTS:
+      q.read(fields[0].data(), HEADER);
+      q.read(fields[1].data(), PAYLOAD);
+      q.read(fields[2].data(), TRAILER);
+      break;
+    case MODE_IOVEC:
+      q.readv(iov);
+      break;
+    case MODE_RANGES:
+      q.readv(fields);
+      break;
+    }
+
+    errors += memcmp(fields[0].data(), &i, sizeof(i)) != 0;
+  }
+
+  return errors;
+}
+
+static int run(mode m, const char *name)
+{
+  spsc::queue q(SIZE);
+  size_t errors = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread t(writer, std::ref(q), m);
+  errors = reader(q, m);
+  t.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf("%s: %lf M records/s, %zu errors\n", name, RECORDS / elapsed.count() * 1E-6, errors);
+
+  return errors ? 1 : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (run(MODE_FRAGMENTS, "Three writes per record"))
+    return 1;
+
+  if (run(MODE_IOVEC, "One writev per record, iovec"))
+    return 1;
+
+  return run(MODE_RANGES, "One writev per record, ranges");
+}
@@ -23,6 +23,25 @@ static T sq_fetch_add_once(std::atomic<T> &var, T value)
   return var.fetch_add(value, std::memory_order_relaxed);
 }
 
+template <typename T>
+static T sq_fetch_or_once(std::atomic<T> &var, T value)
+{
+  return var.fetch_or(value, std::memory_order_relaxed);
+}
+
+template <typename T>
+static T sq_fetch_and_once(std::atomic<T> &var, T value)
+{
+  return var.fetch_and(value, std::memory_order_relaxed);
+}
+
+template <typename T>
+static bool sq_compare_exchange(std::atomic<T> &var, T expected, T desired)
+{
+  return var.compare_exchange_strong(expected, desired, std::memory_order_acq_rel,
+                                     std::memory_order_acquire);
+}
+
 static void sq_thread_fence_release()
 {
   std::atomic_thread_fence(std::memory_order_release);
@@ -40,6 +59,14 @@ static void sq_thread_fence_acquire()
 #define sq_read_once(var)               atomic_load_explicit(&(var), memory_order_relaxed)
 #define sq_store_once(var, value)       atomic_store_explicit(&(var), (value), memory_order_relaxed)
 #define sq_fetch_add_once(var, value)   atomic_fetch_add_explicit(&(var), (value), memory_order_relaxed)
+#define sq_fetch_or_once(var, value)    atomic_fetch_or_explicit(&(var), (value), memory_order_relaxed)
+#define sq_fetch_and_once(var, value)   atomic_fetch_and_explicit(&(var), (value), memory_order_relaxed)
+
+#define sq_compare_exchange(var, expected, desired) ({                                  \
+    __typeof__(expected) sq_expected_ = (expected);                                     \
+    atomic_compare_exchange_strong_explicit(&(var), &sq_expected_, (desired),           \
+                                            memory_order_acq_rel, memory_order_acquire); \
+  })
 
 static void sq_thread_fence_release()
 {
@@ -32,51 +32,51 @@ static inline int circular_area_free(struct circular_area *area)
   return status;
 }
 
-static inline int circular_area_mmap(struct circular_area *area, size_t size, int fd, size_t offset)
+// Reserves an address range without backing it. The range is filled
+// with MAP_FIXED mappings later, so that no other mapping can take an
+// address in between.
+static inline void *circular_area_reserve(size_t size)
 {
-  void *a = MAP_FAILED;
-  void *b = MAP_FAILED;
-  int status = -1;
-
-  int flags = fd == -1 ? MAP_SHARED|MAP_ANONYMOUS : MAP_SHARED;
-
-  do
-  {
-    // we require power of two size
-    if (unlikely(size & (size - 1)))
-      break;
+  return mmap(NULL, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+}
 
-    a = mmap(NULL, 2 * size, PROT_READ|PROT_WRITE, flags, fd, offset);
+// Maps both halves of the area into 2 * size reserved bytes at base with
+// the given protection. Additional mmap flags such as MAP_POPULATE are
+// passed in flags. On failure the reservation is left to the caller.
+static inline int circular_area_mmap_fixed(struct circular_area *area, void *base, size_t size, int fd,
+                                           size_t offset, int prot, int flags)
+{
+  flags |= fd == -1 ? MAP_SHARED|MAP_ANONYMOUS|MAP_FIXED : MAP_SHARED|MAP_FIXED;
 
-    if (unlikely(a == MAP_FAILED))
-      break;
+  // we require power of two size
+  if (unlikely(size & (size - 1)))
+    return -1;
 
-    {
-      void *tmp = mremap(a, 2 * size, size, 0);
+  if (unlikely(mmap(base, size, prot, flags, fd, offset) == MAP_FAILED))
+    return -1;
 
-      if (unlikely(tmp == MAP_FAILED))
-        break;
+  if (unlikely(mmap((char*)base + size, size, prot, flags, fd, offset) == MAP_FAILED))
+    return -1;
 
-      a = tmp;
-    }
+  area->base = base;
+  area->size = size;
+  return 0;
+}
 
-    b = mmap((char *)a + size, size, PROT_READ|PROT_WRITE, flags, fd, offset);
+static inline int circular_area_mmap(struct circular_area *area, size_t size, int fd, size_t offset)
+{
+  void *base = circular_area_reserve(2 * size);
 
-    if (unlikely((char*)b != (char*)a + size))
-      break;
+  if (unlikely(base == MAP_FAILED))
+    return -1;
 
-    area->base = a;
-    area->size = size;
-    return 0;
+  if (unlikely(circular_area_mmap_fixed(area, base, size, fd, offset, PROT_READ|PROT_WRITE, 0)))
+  {
+    munmap(base, 2 * size);
+    return -1;
   }
-  while (0);
 
-  // failure
-  if (a != MAP_FAILED)
-    munmap(a, size);
-  if (b != MAP_FAILED)
-    munmap(b, size);
-  return status;
+  return 0;
 }
 
 static inline int circular_area_allocate_shared(struct circular_area *area, size_t size, char *filename_template)
@@ -96,6 +96,9 @@ static inline int circular_area_allocate_shared(struct circular_area *area, size
 
     status = circular_area_mmap(area, size, fd, 0);
 
+    if (unlikely(status))
+      break;
+
     close(fd);
 
     return 0;
@@ -112,7 +115,21 @@ static inline int circular_area_allocate_shared(struct circular_area *area, size
 
 static inline int circular_area_allocate_shared_anonymous(struct circular_area *area, size_t size)
 {
-  return circular_area_mmap(area, size, -1, 0);
+  // Two MAP_ANONYMOUS mappings never share pages, so the second half
+  // would not mirror the first. Back the area by a memfd instead.
+  int fd = memfd_create("circular_area", MFD_CLOEXEC);
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  int status = ftruncate(fd, size);
+
+  if (likely(!status))
+    status = circular_area_mmap(area, size, fd, 0);
+
+  close(fd);
+
+  return status;
 }
 
 static inline void * circular_area_get_pointer(struct circular_area *area, size_t offset)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <assert.h>
+#include <errno.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
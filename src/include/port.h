@@ -2,3 +2,11 @@
 
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
+
+#if defined(__x86_64__) || defined(__i386__)
+# define sq_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+# define sq_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+# define sq_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
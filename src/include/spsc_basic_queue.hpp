@@ -0,0 +1,536 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <sys/eventfd.h>
+
+#include "spsc_queue.h"
+
+namespace spsc
+{
+  // Header shared between reader and writer. For uint32_t offsets the
+  // layout is that of struct spsc_header, so such queues can be used with
+  // the C functions as well.
+  template <typename OffsetT>
+  struct basic_header
+  {
+    std::atomic<OffsetT> write_offset;
+    std::atomic<size_t> write_size;
+    std::atomic<OffsetT> read_offset;
+    std::atomic<size_t> read_size;
+  };
+
+  static_assert(sizeof(basic_header<uint32_t>) == sizeof(struct spsc_header),
+                "basic_header<uint32_t> must match struct spsc_header");
+  static_assert(offsetof(basic_header<uint32_t>, read_offset) == offsetof(struct spsc_header, read_offset),
+                "basic_header<uint32_t> must match struct spsc_header");
+  static_assert(offsetof(basic_header<uint32_t>, read_size) == offsetof(struct spsc_header, read_size),
+                "basic_header<uint32_t> must match struct spsc_header");
+
+  // Wait policies. Channel 0 is the reader, which waits on the write
+  // offset, channel 1 is the writer, which waits on the read offset.
+
+  // Sleeps on the futex of the offset, like spsc_queue.
+  struct futex_wait
+  {
+    static constexpr bool notifies = true;
+
+    template <typename OffsetT>
+    void wait(int, const std::atomic<OffsetT> &word, OffsetT seen) noexcept
+    {
+      // The futex covers the low 32 bits of the offset, which change with
+      // every commit.
+      ::futex_wait(reinterpret_cast<const std::atomic<unsigned int>*>(&word), (uint32_t)seen);
+    }
+
+    template <typename OffsetT>
+    void wake(int, const std::atomic<OffsetT> &word) noexcept
+    {
+      ::futex_wake(reinterpret_cast<const std::atomic<unsigned int>*>(&word), 1);
+    }
+  };
+
+  // Busy polls. Neither side ever announces that it waits, so commits
+  // never check for waiters.
+  struct spin_wait
+  {
+    static constexpr bool notifies = false;
+
+    template <typename OffsetT>
+    void wait(int, const std::atomic<OffsetT> &, OffsetT) noexcept
+    {
+      sq_cpu_relax();
+    }
+
+    template <typename OffsetT>
+    void wake(int, const std::atomic<OffsetT> &) noexcept
+    {
+    }
+  };
+
+  // Sleeps on one eventfd per direction. The eventfds have to be created
+  // before the queue is shared through fork().
+  struct eventfd_wait
+  {
+    static constexpr bool notifies = true;
+
+    int fds[2];
+
+    eventfd_wait()
+    {
+      fds[0] = eventfd(0, EFD_CLOEXEC);
+      fds[1] = eventfd(0, EFD_CLOEXEC);
+
+      if (fds[0] < 0 || fds[1] < 0)
+      {
+        close_fds();
+        throw std::bad_alloc();
+      }
+    }
+
+    eventfd_wait(const eventfd_wait &) = delete;
+    eventfd_wait &operator=(const eventfd_wait &) = delete;
+
+    ~eventfd_wait()
+    {
+      close_fds();
+    }
+
+    void close_fds() noexcept
+    {
+      for (int fd : fds)
+        if (fd >= 0)
+          close(fd);
+    }
+
+    template <typename OffsetT>
+    void wait(int channel, const std::atomic<OffsetT> &word, OffsetT seen) noexcept
+    {
+      eventfd_t value;
+
+      // Unlike futex_wait the read does not compare the offset, so check
+      // it here. The size was stored and fenced before, so a commit after
+      // this load sees it and wakes us. A wake which happened before we
+      // got here is kept in the counter.
+      if (word.load(std::memory_order_relaxed) != seen)
+        return;
+
+      eventfd_read(fds[channel], &value);
+    }
+
+    template <typename OffsetT>
+    void wake(int channel, const std::atomic<OffsetT> &) noexcept
+    {
+      eventfd_write(fds[channel], 1);
+    }
+  };
+
+  // Statistics policies.
+
+  struct no_stats
+  {
+    void on_write(size_t) noexcept {}
+    void on_read(size_t) noexcept {}
+    void on_wait(int) noexcept {}
+    void on_wake(int) noexcept {}
+  };
+
+  // Process local counters, to be read by the thread which owns the
+  // respective side. The counters of each side get a cache line of their
+  // own, so that counting does not add false sharing between the threads.
+  // Channel 0 is the reader, which waits and wakes the writer on channel
+  // 1, and the other way round.
+  struct counting_stats
+  {
+    struct alignas(64) side
+    {
+      size_t ops = 0;
+      size_t bytes = 0;
+      size_t waits = 0;
+      size_t wakes = 0;
+    };
+
+    side writer;
+    side reader;
+
+    void on_write(size_t bytes) noexcept { writer.ops++; writer.bytes += bytes; }
+    void on_read(size_t bytes) noexcept { reader.ops++; reader.bytes += bytes; }
+    void on_wait(int channel) noexcept { (channel ? writer : reader).waits++; }
+    void on_wake(int channel) noexcept { (channel ? reader : writer).wakes++; }
+  };
+
+  // Copy policies.
+
+  struct memcpy_copy
+  {
+    static void copy(void *dst, const void *src, size_t bytes) noexcept
+    {
+      memcpy(dst, src, bytes);
+    }
+  };
+
+  // rep movsb, which is fast for large copies on CPUs with ERMS.
+  struct movsb_copy
+  {
+    static void copy(void *dst, const void *src, size_t bytes) noexcept
+    {
+#if defined(__x86_64__)
+      __asm__ __volatile__("rep movsb"
+                           : "+D"(dst), "+S"(src), "+c"(bytes)
+                           :
+                           : "memory");
+#else
+      memcpy(dst, src, bytes);
+#endif
+    }
+  };
+
+  // Queue with all features chosen at compile time. A Capacity of 0 means
+  // the capacity is given to the constructor.
+  template <typename OffsetT = uint32_t,
+            typename WaitPolicy = futex_wait,
+            typename StatsPolicy = no_stats,
+            typename CopyPolicy = memcpy_copy,
+            size_t Capacity = 0>
+  class basic_queue
+  {
+    static_assert(std::is_unsigned<OffsetT>::value, "OffsetT must be unsigned");
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static_assert(Capacity == 0 || Capacity <= ((size_t)(OffsetT)~(OffsetT)0 >> 1), "Capacity too large for OffsetT");
+
+  public:
+    using header_type = basic_header<OffsetT>;
+
+  private:
+    header_type *header_;
+    struct circular_area area_;
+    WaitPolicy wait_;
+    StatsPolicy stats_;
+    // Last seen offsets of the other side, which only ever grow. Checking
+    // against them first avoids touching the shared header.
+    alignas(64) OffsetT cached_read_offset_ = 0;
+    alignas(64) OffsetT cached_write_offset_ = 0;
+
+    size_t cap() const noexcept
+    {
+      return Capacity ? Capacity : area_.size;
+    }
+
+    void *pointer(OffsetT offset) const noexcept
+    {
+      return (char*)area_.base + (offset & (cap() - 1));
+    }
+
+    void free_mappings() noexcept
+    {
+      shared_alloc_free(header_, sizeof(header_type));
+      circular_area_free(&area_);
+    }
+
+  public:
+    explicit basic_queue(size_t size = Capacity)
+    {
+      circular_area_init(&area_);
+      header_ = (header_type*)shared_alloc_anonymous(sizeof(header_type));
+
+      if (header_ == MAP_FAILED)
+        throw std::bad_alloc();
+
+      // The distance between the offsets has to fit in OffsetT.
+      if ((Capacity && size != Capacity) || size > ((size_t)(OffsetT)~(OffsetT)0 >> 1) ||
+          circular_area_allocate_shared_anonymous(&area_, size))
+      {
+        free_mappings();
+        throw std::bad_alloc();
+      }
+    }
+
+    basic_queue(const basic_queue &) = delete;
+    basic_queue &operator=(const basic_queue &) = delete;
+
+    ~basic_queue()
+    {
+      free_mappings();
+    }
+
+    // Only valid for OffsetT == uint32_t, which shares the C layout, and
+    // futex_wait, which sleeps and wakes on the same futexes as the C
+    // functions.
+    struct spsc_queue c_queue() const noexcept
+    {
+      static_assert(std::is_same<OffsetT, uint32_t>::value, "only uint32_t offsets match struct spsc_queue");
+      static_assert(std::is_same<WaitPolicy, futex_wait>::value,
+                    "only futex_wait wakes the C functions waiting on the queue");
+      struct spsc_queue q;
+      q.header = reinterpret_cast<struct spsc_header*>(header_);
+      q.area = area_;
+      return q;
+    }
+
+    StatsPolicy &stats() noexcept { return stats_; }
+    WaitPolicy &wait_policy() noexcept { return wait_; }
+
+    size_t capacity() const noexcept
+    {
+      return cap();
+    }
+
+    size_t read_size() const noexcept
+    {
+      return (OffsetT)(header_->write_offset.load(std::memory_order_relaxed) -
+                       header_->read_offset.load(std::memory_order_relaxed));
+    }
+
+    size_t write_size() const noexcept
+    {
+      return cap() - read_size();
+    }
+
+    size_t size() const noexcept
+    {
+      return read_size();
+    }
+
+    bool empty() const noexcept
+    {
+      return size() == 0;
+    }
+
+    void *try_reserve(size_t bytes) noexcept
+    {
+      OffsetT write_offset = header_->write_offset.load(std::memory_order_relaxed);
+
+      if (likely(cap() >= (size_t)(OffsetT)(write_offset - cached_read_offset_) + bytes))
+        return pointer(write_offset);
+
+      cached_read_offset_ = header_->read_offset.load(std::memory_order_acquire);
+
+      if (unlikely(cap() < (size_t)(OffsetT)(write_offset - cached_read_offset_) + bytes))
+        return nullptr;
+
+      return pointer(write_offset);
+    }
+
+    void *reserve(size_t bytes) noexcept
+    {
+      OffsetT write_offset = header_->write_offset.load(std::memory_order_relaxed);
+
+      assert(bytes <= cap());
+
+      if (likely(cap() >= (size_t)(OffsetT)(write_offset - cached_read_offset_) + bytes))
+        return pointer(write_offset);
+
+      while (1)
+      {
+        OffsetT read_offset = header_->read_offset.load(std::memory_order_acquire);
+
+        cached_read_offset_ = read_offset;
+
+        if (likely(cap() >= (size_t)(OffsetT)(write_offset - read_offset) + bytes))
+          return pointer(write_offset);
+
+        if (WaitPolicy::notifies)
+        {
+          // Pairs with the fence in consume(): either it sees the size or
+          // we see its offset.
+          header_->write_size.store(bytes, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+
+          if (header_->read_offset.load(std::memory_order_relaxed) != read_offset)
+            continue;
+        }
+        stats_.on_wait(1);
+        wait_.wait(1, header_->read_offset, read_offset);
+      }
+    }
+
+    void commit(size_t bytes) noexcept
+    {
+      OffsetT write_offset = header_->write_offset.load(std::memory_order_relaxed);
+
+      // Without waiters there is no need for the locked instruction which
+      // orders the store before the check below.
+      if (WaitPolicy::notifies)
+        header_->write_offset.fetch_add((OffsetT)bytes, std::memory_order_release);
+      else
+        header_->write_offset.store((OffsetT)(write_offset + bytes), std::memory_order_release);
+
+      stats_.on_write(bytes);
+
+      if (WaitPolicy::notifies)
+      {
+        // Orders the offset before the size, see peek().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        OffsetT read_offset = header_->read_offset.load(std::memory_order_relaxed);
+        size_t read_size = header_->read_size.load(std::memory_order_relaxed);
+
+        if (unlikely((size_t)(OffsetT)(write_offset - read_offset) < read_size))
+        {
+          stats_.on_wake(0);
+          wait_.wake(0, header_->write_offset);
+        }
+      }
+    }
+
+    const void *try_peek(size_t bytes) noexcept
+    {
+      OffsetT read_offset = header_->read_offset.load(std::memory_order_relaxed);
+
+      if (likely((size_t)(OffsetT)(cached_write_offset_ - read_offset) >= bytes))
+        return pointer(read_offset);
+
+      cached_write_offset_ = header_->write_offset.load(std::memory_order_acquire);
+
+      if (unlikely((size_t)(OffsetT)(cached_write_offset_ - read_offset) < bytes))
+        return nullptr;
+
+      return pointer(read_offset);
+    }
+
+    const void *peek(size_t bytes) noexcept
+    {
+      OffsetT read_offset = header_->read_offset.load(std::memory_order_relaxed);
+
+      assert(bytes <= cap());
+
+      if (likely((size_t)(OffsetT)(cached_write_offset_ - read_offset) >= bytes))
+        return pointer(read_offset);
+
+      while (1)
+      {
+        OffsetT write_offset = header_->write_offset.load(std::memory_order_acquire);
+
+        cached_write_offset_ = write_offset;
+
+        if (likely((size_t)(OffsetT)(write_offset - read_offset) >= bytes))
+          return pointer(read_offset);
+
+        if (WaitPolicy::notifies)
+        {
+          // Pairs with the fence in commit().
+          header_->read_size.store(bytes, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+
+          if (header_->write_offset.load(std::memory_order_relaxed) != write_offset)
+            continue;
+        }
+        stats_.on_wait(0);
+        wait_.wait(0, header_->write_offset, write_offset);
+      }
+    }
+
+    void consume(size_t bytes) noexcept
+    {
+      OffsetT read_offset = header_->read_offset.load(std::memory_order_relaxed);
+
+      if (WaitPolicy::notifies)
+        header_->read_offset.fetch_add((OffsetT)bytes, std::memory_order_release);
+      else
+        header_->read_offset.store((OffsetT)(read_offset + bytes), std::memory_order_release);
+
+      stats_.on_read(bytes);
+
+      if (WaitPolicy::notifies)
+      {
+        // Orders the offset before the size, see reserve().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        OffsetT write_offset = header_->write_offset.load(std::memory_order_relaxed);
+        size_t write_size = header_->write_size.load(std::memory_order_relaxed);
+
+        if (unlikely(cap() < (size_t)(OffsetT)(write_offset - read_offset) + write_size))
+        {
+          stats_.on_wake(1);
+          wait_.wake(1, header_->read_offset);
+        }
+      }
+    }
+
+    void write(const void *src, size_t bytes) noexcept
+    {
+      CopyPolicy::copy(reserve(bytes), src, bytes);
+      commit(bytes);
+    }
+
+    bool try_write(const void *src, size_t bytes) noexcept
+    {
+      void *dst = try_reserve(bytes);
+
+      if (dst == nullptr)
+        return false;
+
+      CopyPolicy::copy(dst, src, bytes);
+      commit(bytes);
+
+      return true;
+    }
+
+    template <typename Func>
+    void write_with(size_t bytes, Func &&f) noexcept( noexcept(f(std::declval<void*>())) )
+    {
+      f(reserve(bytes));
+      commit(bytes);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, void>::type
+    write(const T &value) noexcept
+    {
+      write(reinterpret_cast<const void*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, bool>::type
+    try_write(const T &value) noexcept
+    {
+      return try_write(reinterpret_cast<const void*>(&value), sizeof(T));
+    }
+
+    void read(void *dst, size_t bytes) noexcept
+    {
+      CopyPolicy::copy(dst, peek(bytes), bytes);
+      consume(bytes);
+    }
+
+    bool try_read(void *dst, size_t bytes) noexcept
+    {
+      const void *src = try_peek(bytes);
+
+      if (src == nullptr)
+        return false;
+
+      CopyPolicy::copy(dst, src, bytes);
+      consume(bytes);
+
+      return true;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, T>::type
+    read() noexcept
+    {
+      T tmp;
+      read(reinterpret_cast<void*>(&tmp), sizeof(T));
+      return tmp;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, bool>::type
+    try_read(T &dst) noexcept
+    {
+      return try_read(&dst, sizeof(T));
+    }
+
+    template <typename Func>
+    void read_with(size_t bytes, Func &&f) noexcept(noexcept(f(std::declval<const void*>())))
+    {
+      f(peek(bytes));
+      consume(bytes);
+    }
+  };
+
+  // The configuration of spsc::queue.
+  using default_queue = basic_queue<>;
+}
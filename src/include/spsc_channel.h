@@ -0,0 +1,203 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Bidirectional request/response channel.
+//
+// Request and response ring share one shared memory segment: a header page
+// holding both struct spsc_header on separate cache lines, followed by the
+// request ring and the response ring of equal size. Messages are prefixed
+// with a struct spsc_channel_frame carrying the correlation id and are
+// padded to a multiple of 8 bytes.
+//
+// Readers on both sides poll for up to spins iterations before they sleep
+// on the futex, so that a fast reply is picked up without any syscall on
+// either side. Any number of requests may be outstanding; the server
+// answers them in order.
+
+#define SPSC_CHANNEL_ALIGN          8
+#define SPSC_CHANNEL_DEFAULT_SPINS  4096
+
+struct spsc_channel_header
+{
+  struct spsc_header request;
+  char padding0[64 - sizeof(struct spsc_header)];
+  struct spsc_header response;
+  char padding1[64 - sizeof(struct spsc_header)];
+};
+
+struct spsc_channel_frame
+{
+  uint64_t id;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct spsc_channel
+{
+  struct spsc_channel_header *header;
+  struct spsc_queue request;
+  struct spsc_queue response;
+  unsigned int spins;
+  // Client state.
+  uint64_t next_id;
+};
+
+static inline void spsc_channel_init(struct spsc_channel *ch)
+{
+  ch->header = (struct spsc_channel_header*)MAP_FAILED;
+  spsc_queue_init(&ch->request);
+  spsc_queue_init(&ch->response);
+  ch->spins = SPSC_CHANNEL_DEFAULT_SPINS;
+  ch->next_id = 0;
+}
+
+static inline void spsc_channel_free(struct spsc_channel *ch)
+{
+  ch->header = (struct spsc_channel_header*)shared_alloc_free(ch->header, sizeof(*ch->header));
+  circular_area_free(&ch->request.area);
+  circular_area_free(&ch->response.area);
+}
+
+static inline off_t spsc_channel_shm_size(size_t size)
+{
+  return (off_t)(getpagesize() + 2 * shared_alloc_round_up(size));
+}
+
+static inline int spsc_channel_map(struct spsc_channel *ch, int fd, size_t size)
+{
+  size_t page_size = (size_t)getpagesize();
+  struct spsc_channel_header *header;
+
+  header = (struct spsc_channel_header*)shared_alloc_mmap(sizeof(struct spsc_channel_header), fd, 0);
+
+  if (unlikely(header == MAP_FAILED))
+    return -1;
+
+  if (unlikely(circular_area_mmap(&ch->request.area, size, fd, page_size)))
+  {
+    shared_alloc_free(header, sizeof(*header));
+    return -1;
+  }
+
+  if (unlikely(circular_area_mmap(&ch->response.area, size, fd, page_size + size)))
+  {
+    circular_area_free(&ch->request.area);
+    shared_alloc_free(header, sizeof(*header));
+    return -1;
+  }
+
+  ch->header = header;
+  ch->request.header = &header->request;
+  ch->response.header = &header->response;
+
+  return 0;
+}
+
+// Maps a channel from a file of spsc_channel_shm_size() bytes.
+static inline int spsc_channel_fdopen(struct spsc_channel *ch, int fd)
+{
+  struct stat statbuf;
+  size_t page_size = (size_t)getpagesize();
+
+  if (unlikely(fstat(fd, &statbuf) || (size_t)statbuf.st_size <= page_size))
+    return -1;
+
+  return spsc_channel_map(ch, fd, (statbuf.st_size - page_size) / 2);
+}
+
+// Allocates a channel with two rings of size bytes each. The channel has
+// to be shared through fork().
+static inline int spsc_channel_alloc_anonymous(struct spsc_channel *ch, size_t size)
+{
+  int fd = memfd_create("spsc_channel", MFD_CLOEXEC);
+  int status = -1;
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  if (likely(!ftruncate(fd, spsc_channel_shm_size(size))))
+    status = spsc_channel_map(ch, fd, size);
+
+  close(fd);
+
+  return status;
+}
+
+static inline size_t spsc_channel_stride(size_t size)
+{
+  size += sizeof(struct spsc_channel_frame);
+  return (size + (SPSC_CHANNEL_ALIGN - 1)) & ~(size_t)(SPSC_CHANNEL_ALIGN - 1);
+}
+
+static inline void spsc_channel_put(struct spsc_queue *q, uint64_t id, const void *src, size_t size)
+{
+  size_t stride = spsc_channel_stride(size);
+  char *dst = (char*)spsc_queue_write(q, stride);
+  struct spsc_channel_frame frame = { id, (uint32_t)size, 0 };
+
+  memcpy(dst, &frame, sizeof(frame));
+  memcpy(dst + sizeof(frame), src, size);
+
+  spsc_queue_write_commit(q, stride);
+}
+
+static inline size_t spsc_channel_get(struct spsc_queue *q, unsigned int spins, uint64_t *id,
+                                      void *dst, size_t max)
+{
+  struct spsc_channel_frame frame;
+  const char *src = (const char*)spsc_queue_read_spin(q, sizeof(frame), spins);
+
+  // The writer commits whole frames.
+  memcpy(&frame, src, sizeof(frame));
+  memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+  *id = frame.id;
+
+  spsc_queue_read_commit(q, spsc_channel_stride(frame.size));
+
+  return frame.size;
+}
+
+// Client: sends a request and returns its correlation id.
+static inline uint64_t spsc_channel_send_request(struct spsc_channel *ch, const void *src, size_t size)
+{
+  uint64_t id = ch->next_id++;
+
+  spsc_channel_put(&ch->request, id, src, size);
+
+  return id;
+}
+
+// Client: waits for the next response. Returns its size, of which at
+// most max bytes are copied to dst.
+static inline size_t spsc_channel_recv_response(struct spsc_channel *ch, uint64_t *id, void *dst, size_t max)
+{
+  return spsc_channel_get(&ch->response, ch->spins, id, dst, max);
+}
+
+// Client: sends a request and waits for its response. Must not be mixed
+// with outstanding pipelined requests.
+static inline size_t spsc_channel_call(struct spsc_channel *ch, const void *src, size_t size,
+                                       void *dst, size_t max)
+{
+  uint64_t id = spsc_channel_send_request(ch, src, size);
+  uint64_t response_id;
+  size_t response_size = spsc_channel_recv_response(ch, &response_id, dst, max);
+
+  (void)id;
+  assert(response_id == id);
+
+  return response_size;
+}
+
+// Server: waits for the next request.
+static inline size_t spsc_channel_recv_request(struct spsc_channel *ch, uint64_t *id, void *dst, size_t max)
+{
+  return spsc_channel_get(&ch->request, ch->spins, id, dst, max);
+}
+
+// Server: answers the request with the given id.
+static inline void spsc_channel_send_response(struct spsc_channel *ch, uint64_t id, const void *src, size_t size)
+{
+  spsc_channel_put(&ch->response, id, src, size);
+}
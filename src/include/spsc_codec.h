@@ -0,0 +1,544 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Optional compression for framed records.
+//
+// Each record is prefixed with a struct spsc_codec_frame which stores the
+// size of the encoded payload and, in info, the decoded size and the codec
+// which was used. Records are padded to a multiple of 8 bytes. Records
+// which do not get smaller are stored raw, so a record never takes more
+// space than it would without compression.
+//
+// Large records are compressed in the LZ4 block format. Small records are
+// delta encoded against the previous small record, which is tracked by
+// both writer and reader.
+//
+// The codecs in use are stored in a struct spsc_codec_meta in the header
+// page, right after the struct spsc_header. The writer sets them with
+// spsc_codec_setup(), the reader verifies them with spsc_codec_attach().
+
+enum spsc_codec
+{
+  SPSC_CODEC_RAW    = 0,
+  SPSC_CODEC_LZ4    = 1,
+  SPSC_CODEC_DELTA  = 2,
+};
+
+#define SPSC_CODEC_MAGIC          0x63646373u
+#define SPSC_CODEC_ALIGN          8
+// Records of at most this size are delta encoded.
+#define SPSC_CODEC_DELTA_MAX      256
+// Default minimum size of records compressed with LZ4.
+#define SPSC_CODEC_LZ4_THRESHOLD  1024
+
+// Returned by spsc_codec_read_to() for records which fail to decode.
+#define SPSC_CODEC_ERROR          ((size_t)-1)
+
+#define SPSC_CODEC_INFO_SHIFT     28
+#define SPSC_CODEC_INFO_SIZE      ((1u << SPSC_CODEC_INFO_SHIFT) - 1)
+
+#define SPSC_LZ4_HASH_LOG         12
+#define SPSC_LZ4_MIN_MATCH        4
+#define SPSC_LZ4_MFLIMIT          12
+#define SPSC_LZ4_LAST_LITERALS    5
+#define SPSC_LZ4_MAX_OFFSET       65535
+
+struct spsc_codec_meta
+{
+  SQ_ATOMIC(uint32_t) magic;
+  // Bit mask of (1 << enum spsc_codec) the writer may use.
+  uint32_t codecs;
+  uint32_t lz4_threshold;
+};
+
+struct spsc_codec_frame
+{
+  // Size of the encoded payload.
+  uint32_t size;
+  // Decoded size in the low bits, enum spsc_codec in the high bits.
+  uint32_t info;
+};
+
+struct spsc_codec_queue
+{
+  struct spsc_queue q;
+  struct spsc_codec_meta *meta;
+  uint32_t codecs;
+  uint32_t lz4_threshold;
+  uint32_t prev_size;
+  unsigned char prev[SPSC_CODEC_DELTA_MAX];
+  uint32_t lz4_table[1 << SPSC_LZ4_HASH_LOG];
+};
+
+static inline void spsc_codec_init(struct spsc_codec_queue *cq)
+{
+  spsc_queue_init(&cq->q);
+  cq->meta = NULL;
+  cq->codecs = 0;
+  cq->lz4_threshold = SPSC_CODEC_LZ4_THRESHOLD;
+  cq->prev_size = 0;
+}
+
+static inline void spsc_codec_free(struct spsc_codec_queue *cq)
+{
+  spsc_queue_free(&cq->q);
+  cq->meta = NULL;
+}
+
+static inline int spsc_codec_alloc_anonymous(struct spsc_codec_queue *cq, size_t size)
+{
+  int status = spsc_queue_alloc_anonymous(&cq->q, size);
+
+  if (likely(!status))
+    cq->meta = (struct spsc_codec_meta*)(cq->q.header + 1);
+
+  return status;
+}
+
+static inline int spsc_codec_fdopen(struct spsc_codec_queue *cq, int fd)
+{
+  int status = spsc_queue_fdopen(&cq->q, fd);
+
+  if (likely(!status))
+    cq->meta = (struct spsc_codec_meta*)(cq->q.header + 1);
+
+  return status;
+}
+
+// Called by the writer before the first record is written.
+static inline void spsc_codec_setup(struct spsc_codec_queue *cq, uint32_t codecs, uint32_t lz4_threshold)
+{
+  cq->codecs = codecs;
+  cq->lz4_threshold = lz4_threshold;
+  cq->meta->codecs = codecs;
+  cq->meta->lz4_threshold = lz4_threshold;
+  sq_thread_fence_release();
+  sq_store_once(cq->meta->magic, SPSC_CODEC_MAGIC);
+}
+
+// Called by the reader. Fails if the writer has not set up the queue yet
+// or uses codecs which are not in supported.
+static inline int spsc_codec_attach(struct spsc_codec_queue *cq, uint32_t supported)
+{
+  if (sq_read_once(cq->meta->magic) != SPSC_CODEC_MAGIC)
+    return -1;
+
+  sq_thread_fence_acquire();
+
+  if (cq->meta->codecs & ~supported)
+    return -1;
+
+  cq->codecs = cq->meta->codecs;
+  cq->lz4_threshold = cq->meta->lz4_threshold;
+
+  return 0;
+}
+
+static inline size_t spsc_codec_stride(size_t size)
+{
+  size += sizeof(struct spsc_codec_frame);
+  return (size + (SPSC_CODEC_ALIGN - 1)) & ~(size_t)(SPSC_CODEC_ALIGN - 1);
+}
+
+static inline uint32_t spsc_lz4_read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline unsigned char * spsc_lz4_put_length(unsigned char *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+// Compresses src into the LZ4 block format. Returns the compressed size,
+// or 0 if the result does not fit into cap bytes.
+static inline size_t spsc_lz4_compress(uint32_t *table, const unsigned char *src, size_t n,
+                                       unsigned char *dst, size_t cap)
+{
+  const unsigned char *ip = src;
+  const unsigned char *anchor = src;
+  const unsigned char *const end = src + n;
+  unsigned char *op = dst;
+  unsigned char *const oend = dst + cap;
+
+  if (n > SPSC_LZ4_MFLIMIT)
+  {
+    const unsigned char *const mflimit = end - SPSC_LZ4_MFLIMIT;
+    const unsigned char *const matchlimit = end - SPSC_LZ4_LAST_LITERALS;
+    unsigned misses = 0;
+
+    memset(table, 0, sizeof(uint32_t) << SPSC_LZ4_HASH_LOG);
+    ip++;
+
+    while (ip < mflimit)
+    {
+      uint32_t sequence = spsc_lz4_read32(ip);
+      uint32_t h = (sequence * 2654435761u) >> (32 - SPSC_LZ4_HASH_LOG);
+      const unsigned char *ref = src + table[h];
+
+      table[h] = (uint32_t)(ip - src);
+
+      if (ref >= ip || ip - ref > SPSC_LZ4_MAX_OFFSET || spsc_lz4_read32(ref) != sequence)
+      {
+        // Skip faster through incompressible data.
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+
+      misses = 0;
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1])
+      {
+        ip--;
+        ref--;
+      }
+
+      const unsigned char *m = ip + SPSC_LZ4_MIN_MATCH;
+      const unsigned char *r = ref + SPSC_LZ4_MIN_MATCH;
+
+      while (m < matchlimit && *m == *r)
+      {
+        m++;
+        r++;
+      }
+
+      size_t literals = (size_t)(ip - anchor);
+      size_t match = (size_t)(m - ip) - SPSC_LZ4_MIN_MATCH;
+      uint16_t offset = (uint16_t)(ip - ref);
+
+      if (unlikely((size_t)(oend - op) < 1 + literals + literals / 255 + 1 + 2 + match / 255 + 1))
+        return 0;
+
+      unsigned char *token = op++;
+
+      *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+      if (literals >= 15)
+        op = spsc_lz4_put_length(op, literals - 15);
+      memcpy(op, anchor, literals);
+      op += literals;
+
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+
+      *token |= (unsigned char)(match < 15 ? match : 15);
+      if (match >= 15)
+        op = spsc_lz4_put_length(op, match - 15);
+
+      ip = anchor = m;
+    }
+  }
+
+  size_t literals = (size_t)(end - anchor);
+
+  if (unlikely((size_t)(oend - op) < 1 + literals + literals / 255 + 1))
+    return 0;
+
+  *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15)
+    op = spsc_lz4_put_length(op, literals - 15);
+  memcpy(op, anchor, literals);
+  op += literals;
+
+  return (size_t)(op - dst);
+}
+
+// Decompresses an LZ4 block. Returns the decompressed size, or
+// (size_t)-1 if the input is malformed or does not fit into cap bytes.
+static inline size_t spsc_lz4_decompress(const unsigned char *src, size_t n,
+                                         unsigned char *dst, size_t cap)
+{
+  const unsigned char *ip = src;
+  const unsigned char *const iend = src + n;
+  unsigned char *op = dst;
+  unsigned char *const oend = dst + cap;
+
+  while (ip < iend)
+  {
+    unsigned token = *ip++;
+    size_t literals = token >> 4;
+
+    if (literals == 15)
+    {
+      unsigned char c;
+      do
+      {
+        if (unlikely(ip >= iend))
+          return (size_t)-1;
+        c = *ip++;
+        literals += c;
+      }
+      while (c == 255);
+    }
+
+    if (unlikely((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals))
+      return (size_t)-1;
+
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+
+    // The last sequence has no match.
+    if (ip == iend)
+      break;
+
+    if (unlikely(iend - ip < 2))
+      return (size_t)-1;
+
+    size_t offset = ip[0] | ((size_t)ip[1] << 8);
+    size_t match = (token & 15);
+
+    ip += 2;
+
+    if (match == 15)
+    {
+      unsigned char c;
+      do
+      {
+        if (unlikely(ip >= iend))
+          return (size_t)-1;
+        c = *ip++;
+        match += c;
+      }
+      while (c == 255);
+    }
+
+    match += SPSC_LZ4_MIN_MATCH;
+
+    if (unlikely(!offset || offset > (size_t)(op - dst) || (size_t)(oend - op) < match))
+      return (size_t)-1;
+
+    const unsigned char *ref = op - offset;
+
+    if (offset >= match)
+    {
+      memcpy(op, ref, match);
+      op += match;
+    }
+    else
+    {
+      // Overlapping match, which repeats the last offset bytes.
+      while (match--)
+        *op++ = *ref++;
+    }
+  }
+
+  return (size_t)(op - dst);
+}
+
+static inline unsigned char * spsc_delta_put_varint(unsigned char *op, size_t v)
+{
+  while (v >= 0x80)
+  {
+    *op++ = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  *op++ = (unsigned char)v;
+  return op;
+}
+
+static inline const unsigned char * spsc_delta_get_varint(const unsigned char *ip, const unsigned char *iend,
+                                                          size_t *v)
+{
+  size_t result = 0;
+
+  for (unsigned shift = 0; ip < iend && shift < 32; shift += 7)
+  {
+    unsigned char c = *ip++;
+    result |= (size_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+    {
+      *v = result;
+      return ip;
+    }
+  }
+
+  return NULL;
+}
+
+// Encodes src as a list of (unchanged bytes, changed bytes, changed data)
+// against the previous record. Returns the encoded size, or 0 if the
+// result does not fit into cap bytes.
+static inline size_t spsc_delta_encode(const unsigned char *prev, size_t prev_size,
+                                       const unsigned char *src, size_t n,
+                                       unsigned char *dst, size_t cap)
+{
+  unsigned char *op = dst;
+  unsigned char *const oend = dst + cap;
+  size_t pos = 0;
+
+  while (pos < n)
+  {
+    size_t same = 0;
+    size_t changed = 0;
+
+    while (pos + same < n && pos + same < prev_size && src[pos + same] == prev[pos + same])
+      same++;
+
+    // A changed run only ends at two unchanged bytes, a single one is
+    // cheaper to store as part of it.
+    for (size_t i = pos + same; i < n; i++, changed++)
+    {
+      if (i + 1 < prev_size && i + 1 < n && src[i] == prev[i] && src[i + 1] == prev[i + 1])
+        break;
+    }
+
+    // varints of at most SPSC_CODEC_DELTA_MAX take two bytes each
+    if (unlikely((size_t)(oend - op) < 4 + changed))
+      return 0;
+
+    op = spsc_delta_put_varint(op, same);
+    op = spsc_delta_put_varint(op, changed);
+    memcpy(op, src + pos + same, changed);
+    op += changed;
+    pos += same + changed;
+  }
+
+  return (size_t)(op - dst);
+}
+
+// Returns the decoded size, or (size_t)-1 on malformed input.
+static inline size_t spsc_delta_decode(const unsigned char *prev, size_t prev_size,
+                                       const unsigned char *src, size_t n,
+                                       unsigned char *dst, size_t cap)
+{
+  const unsigned char *ip = src;
+  const unsigned char *const iend = src + n;
+  size_t pos = 0;
+
+  while (ip < iend)
+  {
+    size_t same, changed;
+
+    ip = spsc_delta_get_varint(ip, iend, &same);
+    if (unlikely(!ip))
+      return (size_t)-1;
+    ip = spsc_delta_get_varint(ip, iend, &changed);
+    if (unlikely(!ip))
+      return (size_t)-1;
+
+    if (unlikely(pos + same > prev_size || pos + same + changed > cap ||
+                 (size_t)(iend - ip) < changed))
+      return (size_t)-1;
+
+    memcpy(dst + pos, prev + pos, same);
+    pos += same;
+    memcpy(dst + pos, ip, changed);
+    pos += changed;
+    ip += changed;
+  }
+
+  return pos;
+}
+
+static inline void spsc_codec_remember(struct spsc_codec_queue *cq, const void *data, size_t size)
+{
+  if (size <= SPSC_CODEC_DELTA_MAX)
+  {
+    memcpy(cq->prev, data, size);
+    cq->prev_size = (uint32_t)size;
+  }
+}
+
+// Writes one record, compressing it if that makes it smaller. Returns the
+// number of bytes used in the ring, excluding the frame.
+static inline size_t spsc_codec_write_from(struct spsc_codec_queue *cq, const void *src, size_t size)
+{
+  // Encoded records are always smaller than raw ones, so reserving space
+  // for the raw record is enough to encode directly into the ring.
+  char *dst = (char*)spsc_queue_write(&cq->q, spsc_codec_stride(size));
+  unsigned char *payload = (unsigned char*)dst + sizeof(struct spsc_codec_frame);
+  struct spsc_codec_frame frame;
+  uint32_t codec = SPSC_CODEC_RAW;
+  size_t encoded = 0;
+
+  assert(size <= SPSC_CODEC_INFO_SIZE);
+
+  if (size >= cq->lz4_threshold && size > SPSC_LZ4_MFLIMIT && (cq->codecs & (1u << SPSC_CODEC_LZ4)))
+  {
+    encoded = spsc_lz4_compress(cq->lz4_table, (const unsigned char*)src, size, payload, size - 1);
+    codec = SPSC_CODEC_LZ4;
+  }
+  else if (size <= SPSC_CODEC_DELTA_MAX && size && (cq->codecs & (1u << SPSC_CODEC_DELTA)))
+  {
+    encoded = spsc_delta_encode(cq->prev, cq->prev_size, (const unsigned char*)src, size, payload, size - 1);
+    codec = SPSC_CODEC_DELTA;
+  }
+
+  if (!encoded)
+  {
+    memcpy(payload, src, size);
+    encoded = size;
+    codec = SPSC_CODEC_RAW;
+  }
+
+  frame.size = (uint32_t)encoded;
+  frame.info = (uint32_t)size | (codec << SPSC_CODEC_INFO_SHIFT);
+  memcpy(dst, &frame, sizeof(frame));
+
+  spsc_codec_remember(cq, src, size);
+
+  spsc_queue_write_commit(&cq->q, spsc_codec_stride(encoded));
+
+  return encoded;
+}
+
+// Waits for the next record and decodes it into dst. Returns the decoded
+// size of the record. If that is larger than max, the record stays in the
+// queue so that it can be read again with a larger buffer.
+//
+// Returns SPSC_CODEC_ERROR if the record is malformed or uses an unknown
+// codec. The record is consumed and the contents of dst are undefined.
+// The delta state is reset, so later delta records, which the writer
+// encoded against records the reader no longer has, fail as well instead
+// of decoding to wrong data.
+static inline size_t spsc_codec_read_to(struct spsc_codec_queue *cq, void *dst, size_t max)
+{
+  struct spsc_codec_frame frame;
+  const unsigned char *src = (const unsigned char*)spsc_queue_read(&cq->q, sizeof(frame));
+  size_t expected;
+  size_t size;
+
+  memcpy(&frame, src, sizeof(frame));
+  src += sizeof(frame);
+  expected = frame.info & SPSC_CODEC_INFO_SIZE;
+
+  if (unlikely(expected > max))
+    return expected;
+
+  switch (frame.info >> SPSC_CODEC_INFO_SHIFT)
+  {
+  case SPSC_CODEC_RAW:
+    size = frame.size == expected ? expected : SPSC_CODEC_ERROR;
+    if (likely(size != SPSC_CODEC_ERROR))
+      memcpy(dst, src, size);
+    break;
+  case SPSC_CODEC_LZ4:
+    size = spsc_lz4_decompress(src, frame.size, (unsigned char*)dst, expected);
+    break;
+  case SPSC_CODEC_DELTA:
+    size = spsc_delta_decode(cq->prev, cq->prev_size, src, frame.size, (unsigned char*)dst, expected);
+    break;
+  default:
+    size = SPSC_CODEC_ERROR;
+  }
+
+  if (unlikely(size != expected))
+  {
+    cq->prev_size = 0;
+    size = SPSC_CODEC_ERROR;
+  }
+  else
+  {
+    spsc_codec_remember(cq, dst, size);
+  }
+
+  spsc_queue_read_commit(&cq->q, spsc_codec_stride(frame.size));
+
+  return size;
+}
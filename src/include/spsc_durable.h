@@ -0,0 +1,380 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <fcntl.h>
+
+#ifdef __SSE4_2__
+# include <nmmintrin.h>
+#endif
+
+// File backed queue which survives restarts.
+//
+// The file has the same layout as a named queue (see spsc_queue_shm_size()),
+// with a struct spsc_durable_meta stored in the header page right after the
+// struct spsc_header. Records are prefixed with a struct spsc_durable_frame
+// and padded to a multiple of 8 bytes.
+//
+// The writer flushes the ring to disk with msync() once sync_bytes have been
+// committed since the last flush, or whenever spsc_durable_sync() is called
+// at a batch boundary. After the data has reached the disk, the write offset
+// is stored as checkpoint in the meta data. The reader checkpoints its read
+// offset the same way. spsc_durable_recover() resets the queue to the last
+// checkpoints.
+
+#define SPSC_DURABLE_MAGIC    0x3152554463737073ull
+#define SPSC_DURABLE_VERSION  1
+#define SPSC_DURABLE_ALIGN    8
+
+enum spsc_durable_flags
+{
+  // Store a CRC32C with each record, which is checked during recovery.
+  // Records after the last write checkpoint are recovered if their
+  // checksum matches.
+  SPSC_DURABLE_CHECKSUM = 1,
+};
+
+struct spsc_durable_meta
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint64_t capacity;
+  // Write offset up to which all records have been flushed to disk.
+  SQ_ATOMIC(uint32_t) write_checkpoint;
+  // Read offset up to which all records have been consumed.
+  SQ_ATOMIC(uint32_t) read_checkpoint;
+};
+
+struct spsc_durable_frame
+{
+  uint32_t size;
+  // CRC32C of offset and payload, or 0 if checksums are disabled.
+  uint32_t crc;
+};
+
+struct spsc_durable_queue
+{
+  struct spsc_queue q;
+  struct spsc_durable_meta *meta;
+  // Number of bytes committed between two flushes. 0 flushes on every
+  // commit.
+  size_t sync_bytes;
+
+  // Writer state.
+  uint32_t write_synced;
+  // Reader state.
+  uint32_t read_synced;
+  uint32_t read_stride;
+};
+
+static inline uint32_t spsc_durable_crc32c(uint32_t crc, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+
+  crc = ~crc;
+
+#ifdef __SSE4_2__
+  for (; len >= 8; len -= 8, p += 8)
+  {
+    uint64_t tmp;
+    memcpy(&tmp, p, 8);
+    crc = (uint32_t)_mm_crc32_u64(crc, tmp);
+  }
+  for (; len; len--)
+    crc = _mm_crc32_u8(crc, *p++);
+#else
+  static uint32_t table[256];
+
+  if (unlikely(!table[1]))
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t v = i;
+      for (int k = 0; k < 8; k++)
+        v = (v >> 1) ^ (0x82F63B78u & (0u - (v & 1)));
+      table[i] = v;
+    }
+  }
+
+  for (; len; len--)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+#endif
+
+  return ~crc;
+}
+
+static inline size_t spsc_durable_stride(size_t size)
+{
+  size += sizeof(struct spsc_durable_frame);
+  return (size + (SPSC_DURABLE_ALIGN - 1)) & ~(size_t)(SPSC_DURABLE_ALIGN - 1);
+}
+
+static inline uint32_t spsc_durable_checksum(const struct spsc_durable_queue *dq, uint32_t offset,
+                                             const void *payload, uint32_t size)
+{
+  if (!(dq->meta->flags & SPSC_DURABLE_CHECKSUM))
+    return 0;
+
+  // Seeding with the offset makes sure that zero filled or stale ring
+  // contents never look like valid records.
+  uint32_t crc = spsc_durable_crc32c(0, &offset, sizeof(offset));
+  crc = spsc_durable_crc32c(crc, &size, sizeof(size));
+  return spsc_durable_crc32c(crc, payload, size);
+}
+
+static inline void spsc_durable_init(struct spsc_durable_queue *dq)
+{
+  spsc_queue_init(&dq->q);
+  dq->meta = NULL;
+  dq->sync_bytes = 0;
+  dq->write_synced = 0;
+  dq->read_synced = 0;
+  dq->read_stride = 0;
+}
+
+static inline void spsc_durable_free(struct spsc_durable_queue *dq)
+{
+  spsc_queue_free(&dq->q);
+  dq->meta = NULL;
+}
+
+static inline int spsc_durable_sync_meta(struct spsc_durable_queue *dq)
+{
+  return msync(dq->q.header, (size_t)getpagesize(), MS_SYNC);
+}
+
+// Opens or creates the queue file at path. A new file is created with a
+// ring of the given size and flags, for an existing file both are taken
+// from the meta data, which is validated. Returns 0 on success.
+static inline int spsc_durable_open(struct spsc_durable_queue *dq, const char *path, size_t size,
+                                    uint32_t flags)
+{
+  struct stat statbuf;
+  int status = -1;
+  int created = 0;
+  int fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  do
+  {
+    if (unlikely(fstat(fd, &statbuf)))
+      break;
+
+    if (statbuf.st_size == 0)
+    {
+      if (unlikely(ftruncate(fd, spsc_queue_shm_size(size))))
+        break;
+      created = 1;
+    }
+
+    if (unlikely(spsc_queue_fdopen(&dq->q, fd)))
+      break;
+
+    dq->meta = (struct spsc_durable_meta*)(dq->q.header + 1);
+
+    if (created)
+    {
+      dq->meta->magic = SPSC_DURABLE_MAGIC;
+      dq->meta->version = SPSC_DURABLE_VERSION;
+      dq->meta->flags = flags;
+      dq->meta->capacity = spsc_queue_capacity(&dq->q);
+
+      if (unlikely(spsc_durable_sync_meta(dq)))
+        break;
+    }
+    else if (dq->meta->magic != SPSC_DURABLE_MAGIC ||
+             dq->meta->version != SPSC_DURABLE_VERSION ||
+             dq->meta->capacity != spsc_queue_capacity(&dq->q))
+    {
+      errno = EINVAL;
+      break;
+    }
+
+    dq->write_synced = sq_read_once(dq->q.header->write_offset);
+    dq->read_synced = sq_read_once(dq->q.header->read_offset);
+    close(fd);
+    return 0;
+  }
+  while (0);
+
+  if (dq->q.header != MAP_FAILED)
+  {
+    spsc_queue_free(&dq->q);
+    spsc_queue_init(&dq->q);
+  }
+  dq->meta = NULL;
+  close(fd);
+
+  if (created)
+    unlink(path);
+
+  return status;
+}
+
+// Resets the queue to the state stored in the last checkpoints. This has
+// to be called by one side after a restart, before the other side
+// attaches. With SPSC_DURABLE_CHECKSUM, the records are validated and
+// intact records written after the last write checkpoint are recovered.
+// Returns the number of bytes available for reading.
+static inline size_t spsc_durable_recover(struct spsc_durable_queue *dq)
+{
+  struct spsc_header *header = dq->q.header;
+  size_t capacity = spsc_queue_capacity(&dq->q);
+  uint32_t read_offset = sq_read_once(dq->meta->read_checkpoint);
+  uint32_t write_offset = sq_read_once(dq->meta->write_checkpoint);
+
+  // The reader may have checkpointed records which were not flushed yet.
+  if ((uint32_t)(write_offset - read_offset) > capacity)
+    write_offset = read_offset;
+
+  if (dq->meta->flags & SPSC_DURABLE_CHECKSUM)
+  {
+    uint32_t offset = read_offset;
+
+    while ((uint32_t)(offset - read_offset) + sizeof(struct spsc_durable_frame) <= capacity)
+    {
+      struct spsc_durable_frame frame;
+      const char *src = (const char*)circular_area_get_pointer(&dq->q.area, offset);
+
+      memcpy(&frame, src, sizeof(frame));
+
+      size_t stride = spsc_durable_stride(frame.size);
+
+      if (stride > capacity - (uint32_t)(offset - read_offset) ||
+          frame.crc != spsc_durable_checksum(dq, offset, src + sizeof(frame), frame.size))
+        break;
+
+      offset += (uint32_t)stride;
+    }
+
+    // Also truncates damaged records before the checkpoint.
+    write_offset = offset;
+  }
+
+  sq_store_once(header->read_offset, read_offset);
+  sq_store_once(header->write_offset, write_offset);
+  sq_store_once(header->read_size, (size_t)0);
+  sq_store_once(header->write_size, (size_t)0);
+  sq_store_once(dq->meta->write_checkpoint, write_offset);
+  dq->write_synced = write_offset;
+  dq->read_synced = read_offset;
+  dq->read_stride = 0;
+  spsc_durable_sync_meta(dq);
+
+  return write_offset - read_offset;
+}
+
+// Flushes all committed records and stores the write checkpoint.
+static inline int spsc_durable_sync(struct spsc_durable_queue *dq)
+{
+  uint32_t write_offset = sq_read_once(dq->q.header->write_offset);
+  size_t length = write_offset - dq->write_synced;
+
+  if (!length)
+    return 0;
+
+  // The unsynced range is contiguous in the double mapping, even if it
+  // wraps around the end of the ring.
+  size_t page_size = (size_t)getpagesize();
+  uintptr_t start = (uintptr_t)circular_area_get_pointer(&dq->q.area, dq->write_synced);
+  uintptr_t end = start + length;
+
+  start &= ~(uintptr_t)(page_size - 1);
+
+  if (unlikely(msync((void*)start, end - start, MS_SYNC)))
+    return -1;
+
+  sq_store_once(dq->meta->write_checkpoint, write_offset);
+  dq->write_synced = write_offset;
+
+  return spsc_durable_sync_meta(dq);
+}
+
+// Stores the read checkpoint.
+static inline int spsc_durable_read_sync(struct spsc_durable_queue *dq)
+{
+  uint32_t read_offset = sq_read_once(dq->q.header->read_offset);
+
+  if (read_offset == dq->read_synced)
+    return 0;
+
+  sq_store_once(dq->meta->read_checkpoint, read_offset);
+  dq->read_synced = read_offset;
+
+  return spsc_durable_sync_meta(dq);
+}
+
+static inline void * spsc_durable_write(struct spsc_durable_queue *dq, size_t size)
+{
+  char *dst = (char*)spsc_queue_write(&dq->q, spsc_durable_stride(size));
+
+  return dst + sizeof(struct spsc_durable_frame);
+}
+
+static inline void spsc_durable_write_commit(struct spsc_durable_queue *dq, size_t size)
+{
+  uint32_t write_offset = sq_read_once(dq->q.header->write_offset);
+  char *dst = (char*)circular_area_get_pointer(&dq->q.area, write_offset);
+  struct spsc_durable_frame frame;
+
+  frame.size = (uint32_t)size;
+  frame.crc = spsc_durable_checksum(dq, write_offset, dst + sizeof(frame), frame.size);
+  memcpy(dst, &frame, sizeof(frame));
+
+  spsc_queue_write_commit(&dq->q, spsc_durable_stride(size));
+
+  if ((size_t)(uint32_t)(write_offset - dq->write_synced) + spsc_durable_stride(size) > dq->sync_bytes)
+    spsc_durable_sync(dq);
+}
+
+static inline void spsc_durable_write_from(struct spsc_durable_queue *dq, const void *src, size_t size)
+{
+  void *dst = spsc_durable_write(dq, size);
+
+  memcpy(dst, src, size);
+
+  spsc_durable_write_commit(dq, size);
+}
+
+// Waits for the next record and returns a pointer to its payload. The
+// size of the payload is stored in *size.
+static inline const void * spsc_durable_read(struct spsc_durable_queue *dq, size_t *size)
+{
+  struct spsc_durable_frame frame;
+  const char *src = (const char*)spsc_queue_read(&dq->q, sizeof(frame));
+
+  memcpy(&frame, src, sizeof(frame));
+  dq->read_stride = (uint32_t)spsc_durable_stride(frame.size);
+  *size = frame.size;
+
+  return src + sizeof(frame);
+}
+
+static inline void spsc_durable_read_commit(struct spsc_durable_queue *dq)
+{
+  uint32_t read_offset = sq_read_once(dq->q.header->read_offset);
+
+  spsc_queue_read_commit(&dq->q, dq->read_stride);
+
+  if ((size_t)(uint32_t)(read_offset - dq->read_synced) + dq->read_stride > dq->sync_bytes)
+    spsc_durable_read_sync(dq);
+
+  dq->read_stride = 0;
+}
+
+// Reads the next record into dst and returns its size. At most max bytes
+// are copied.
+static inline size_t spsc_durable_read_to(struct spsc_durable_queue *dq, void *dst, size_t max)
+{
+  size_t size;
+  const void *src = spsc_durable_read(dq, &size);
+
+  memcpy(dst, src, size < max ? size : max);
+
+  spsc_durable_read_commit(dq);
+
+  return size;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+
+// Named queue which grows and shrinks while in use.
+//
+// A control object called name holds the current epoch of reader and
+// writer. The ring of each epoch is a separate named queue called
+// name.<epoch>. Records are prefixed with a struct spsc_elastic_frame and
+// padded to a multiple of 8 bytes.
+//
+// To resize, the writer creates the ring of the next epoch, appends a
+// switch marker to the current ring and continues in the new one. The
+// reader drains the old ring up to the marker, follows it to the new ring
+// and removes the old one. The unread tail is therefore never copied, and
+// neither side has to stop. Space for the marker is always kept free in
+// every ring.
+//
+// The writer grows the ring when a record does not fit, up to max_size.
+// It shrinks the ring when occupancy has stayed below a quarter of the
+// capacity for SPSC_ELASTIC_SHRINK_CHECKS consecutive checks. Writes check
+// every SPSC_ELASTIC_CHECK_INTERVAL records; a writer which may go quiet
+// calls spsc_elastic_maintain() from time to time, e.g. from its idle
+// loop or a timer, so that the ring also shrinks without writes.
+
+#define SPSC_ELASTIC_ALIGN          8
+// Occupancy is checked every this many writes.
+#define SPSC_ELASTIC_CHECK_INTERVAL 1024
+#define SPSC_ELASTIC_SHRINK_CHECKS  64
+
+enum spsc_elastic_frame_type
+{
+  SPSC_ELASTIC_FRAME_DATA,
+  SPSC_ELASTIC_FRAME_SWITCH,
+};
+
+struct spsc_elastic_frame
+{
+  uint32_t size;
+  uint32_t type;
+};
+
+struct spsc_elastic_control
+{
+  SQ_ATOMIC(uint32_t) write_epoch;
+  SQ_ATOMIC(uint32_t) read_epoch;
+  SQ_ATOMIC(size_t) write_capacity;
+  size_t min_size;
+  size_t max_size;
+};
+
+struct spsc_elastic_queue
+{
+  char name[NAME_MAX];
+  struct spsc_elastic_control *control;
+  struct spsc_queue ring;
+  uint32_t epoch;
+
+  // Writer state.
+  size_t writes;
+  unsigned int idle_checks;
+};
+
+static inline void spsc_elastic_init(struct spsc_elastic_queue *q)
+{
+  q->name[0] = 0;
+  q->control = (struct spsc_elastic_control*)MAP_FAILED;
+  spsc_queue_init(&q->ring);
+  q->epoch = 0;
+  q->writes = 0;
+  q->idle_checks = 0;
+}
+
+static inline int spsc_elastic_ring_name(char *dst, const char *name, uint32_t epoch)
+{
+  int n = snprintf(dst, NAME_MAX, "%s.%u", name, epoch);
+
+  return n > 0 && n < NAME_MAX ? 0 : -1;
+}
+
+static inline void spsc_elastic_close_ring(struct spsc_queue *ring)
+{
+  spsc_queue_free(ring);
+}
+
+static inline int spsc_elastic_open_ring(struct spsc_elastic_queue *q, uint32_t epoch, size_t create_size)
+{
+  char ring_name[NAME_MAX];
+  struct spsc_queue ring;
+  int fd;
+
+  if (unlikely(spsc_elastic_ring_name(ring_name, q->name, epoch)))
+    return -1;
+
+  if (create_size)
+  {
+    fd = shm_open(ring_name, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+
+    if (unlikely(fd < 0))
+      return -1;
+
+    if (unlikely(ftruncate(fd, spsc_queue_shm_size(create_size))))
+    {
+      close(fd);
+      shm_unlink(ring_name);
+      return -1;
+    }
+  }
+  else
+  {
+    fd = shm_open(ring_name, O_RDWR|O_CLOEXEC, 0644);
+
+    if (unlikely(fd < 0))
+      return -1;
+  }
+
+  spsc_queue_init(&ring);
+
+  int status = spsc_queue_fdopen(&ring, fd);
+
+  close(fd);
+
+  if (unlikely(status))
+  {
+    if (create_size)
+      shm_unlink(ring_name);
+    return status;
+  }
+
+  if (q->ring.header != MAP_FAILED)
+    spsc_elastic_close_ring(&q->ring);
+
+  q->ring = ring;
+  q->epoch = epoch;
+
+  return 0;
+}
+
+static inline int spsc_elastic_map_control(struct spsc_elastic_queue *q, const char *name, int flags)
+{
+  int fd;
+
+  if (unlikely(strlen(name) + 12 >= NAME_MAX))
+    return -1;
+
+  strcpy(q->name, name);
+
+  fd = shm_open(name, O_RDWR|O_CLOEXEC|flags, 0644);
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  if ((flags & O_CREAT) && unlikely(ftruncate(fd, (off_t)shared_alloc_round_up(sizeof(struct spsc_elastic_control)))))
+  {
+    close(fd);
+    return -1;
+  }
+
+  q->control = (struct spsc_elastic_control*)shared_alloc_mmap(sizeof(struct spsc_elastic_control), fd, 0);
+  close(fd);
+
+  return q->control == MAP_FAILED ? -1 : 0;
+}
+
+// Creates the control object and the first ring and attaches as writer.
+// All sizes have to be powers of two and multiples of the page size.
+static inline int spsc_elastic_create(struct spsc_elastic_queue *q, const char *name, size_t size,
+                                      size_t min_size, size_t max_size)
+{
+  if (unlikely(min_size > size || size > max_size))
+    return -1;
+
+  if (unlikely(spsc_elastic_map_control(q, name, O_CREAT|O_EXCL)))
+    return -1;
+
+  q->control->min_size = min_size;
+  q->control->max_size = max_size;
+  sq_store_once(q->control->write_capacity, size);
+
+  if (unlikely(spsc_elastic_open_ring(q, 0, size)))
+  {
+    shm_unlink(name);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Attaches to an existing queue as reader.
+static inline int spsc_elastic_open_reader(struct spsc_elastic_queue *q, const char *name)
+{
+  if (unlikely(spsc_elastic_map_control(q, name, 0)))
+    return -1;
+
+  return spsc_elastic_open_ring(q, sq_read_once(q->control->read_epoch), 0);
+}
+
+// Attaches to an existing queue as writer.
+static inline int spsc_elastic_open_writer(struct spsc_elastic_queue *q, const char *name)
+{
+  if (unlikely(spsc_elastic_map_control(q, name, 0)))
+    return -1;
+
+  return spsc_elastic_open_ring(q, sq_read_once(q->control->write_epoch), 0);
+}
+
+static inline void spsc_elastic_free(struct spsc_elastic_queue *q)
+{
+  q->control = (struct spsc_elastic_control*)shared_alloc_free(q->control, sizeof(struct spsc_elastic_control));
+  if (q->ring.header != MAP_FAILED)
+    spsc_elastic_close_ring(&q->ring);
+}
+
+// Removes the control object and all rings which are still in use.
+static inline void spsc_elastic_unlink(struct spsc_elastic_queue *q)
+{
+  char ring_name[NAME_MAX];
+  uint32_t epoch = sq_read_once(q->control->read_epoch);
+  uint32_t last = sq_read_once(q->control->write_epoch);
+
+  do
+  {
+    if (!spsc_elastic_ring_name(ring_name, q->name, epoch))
+      shm_unlink(ring_name);
+  }
+  while (epoch++ != last);
+
+  shm_unlink(q->name);
+}
+
+static inline size_t spsc_elastic_capacity(const struct spsc_elastic_queue *q)
+{
+  return spsc_queue_capacity(&q->ring);
+}
+
+static inline size_t spsc_elastic_stride(size_t size)
+{
+  size += sizeof(struct spsc_elastic_frame);
+  return (size + (SPSC_ELASTIC_ALIGN - 1)) & ~(size_t)(SPSC_ELASTIC_ALIGN - 1);
+}
+
+static inline void spsc_elastic_put(void *dst, uint32_t type, const void *src, size_t size)
+{
+  struct spsc_elastic_frame frame = { (uint32_t)size, type };
+
+  memcpy(dst, &frame, sizeof(frame));
+  if (size)
+    memcpy((char*)dst + sizeof(frame), src, size);
+}
+
+// Writer: moves to a new ring of the given size. Returns 0 on success.
+static inline int spsc_elastic_resize(struct spsc_elastic_queue *q, size_t size)
+{
+  struct spsc_queue old = q->ring;
+  const size_t marker = spsc_elastic_stride(0);
+
+  if (unlikely(size < q->control->min_size || size > q->control->max_size))
+    return -1;
+
+  // Detach the old ring, so that opening the new one does not unmap it.
+  spsc_queue_init(&q->ring);
+
+  if (unlikely(spsc_elastic_open_ring(q, q->epoch + 1, size)))
+  {
+    q->ring = old;
+    return -1;
+  }
+
+  sq_store_once(q->control->write_capacity, size);
+  sq_store_once(q->control->write_epoch, q->epoch);
+
+  // Space for the marker is always kept free.
+  void *dst = spsc_queue_try_write(&old, marker);
+
+  assert(dst);
+  spsc_elastic_put(dst, SPSC_ELASTIC_FRAME_SWITCH, NULL, 0);
+  spsc_queue_write_commit(&old, marker);
+
+  spsc_elastic_close_ring(&old);
+  q->idle_checks = 0;
+
+  return 0;
+}
+
+// Returns 1 if the ring was shrunk.
+static inline int spsc_elastic_check_shrink(struct spsc_elastic_queue *q)
+{
+  size_t capacity = spsc_elastic_capacity(q);
+
+  if (spsc_queue_read_size(&q->ring) >= capacity / 4 || capacity / 2 < q->control->min_size)
+  {
+    q->idle_checks = 0;
+    return 0;
+  }
+
+  // The unread data stays in the old ring, so the new one only has to
+  // be large enough for new records.
+  if (++q->idle_checks >= SPSC_ELASTIC_SHRINK_CHECKS)
+    return spsc_elastic_resize(q, capacity / 2) == 0;
+
+  return 0;
+}
+
+// Writer: runs one occupancy check without writing. A ring halves after
+// SPSC_ELASTIC_SHRINK_CHECKS calls in a row at low occupancy, so calling
+// this every millisecond shrinks an idle ring by half every 64 ms, down
+// to min_size. Returns 1 if the ring was shrunk.
+static inline int spsc_elastic_maintain(struct spsc_elastic_queue *q)
+{
+  return spsc_elastic_check_shrink(q);
+}
+
+// Writer: appends a record, growing the ring if it does not fit. Waits for
+// the reader if the ring cannot grow. Returns -1 if the record cannot fit
+// into a ring of max_size bytes, or into the current ring when growing it
+// fails, since waiting would never end.
+static inline int spsc_elastic_write_from(struct spsc_elastic_queue *q, const void *src, size_t size)
+{
+  const size_t marker = spsc_elastic_stride(0);
+  size_t stride = spsc_elastic_stride(size);
+  void *dst;
+
+  while (1)
+  {
+    size_t capacity = spsc_elastic_capacity(q);
+
+    if (likely(stride + marker <= capacity))
+    {
+      dst = spsc_queue_try_write(&q->ring, stride + marker);
+
+      if (likely(dst != NULL))
+        break;
+    }
+
+    size_t grown = capacity * 2;
+
+    while (grown < stride + marker)
+      grown *= 2;
+
+    if (grown > q->control->max_size || spsc_elastic_resize(q, grown))
+    {
+      if (unlikely(stride + marker > capacity))
+        return -1;
+
+      // Cannot grow, wait for the reader instead.
+      dst = spsc_queue_write(&q->ring, stride + marker);
+      break;
+    }
+  }
+
+  spsc_elastic_put(dst, SPSC_ELASTIC_FRAME_DATA, src, size);
+  spsc_queue_write_commit(&q->ring, stride);
+
+  if (unlikely(++q->writes % SPSC_ELASTIC_CHECK_INTERVAL == 0))
+    spsc_elastic_check_shrink(q);
+
+  return 0;
+}
+
+// Reader: waits for the next record and copies at most max bytes of it to
+// dst. Returns the size of the record, or (size_t)-1 if the next ring
+// could not be opened, in which case the call can be repeated.
+static inline size_t spsc_elastic_read_to(struct spsc_elastic_queue *q, void *dst, size_t max)
+{
+  while (1)
+  {
+    struct spsc_elastic_frame frame;
+    const char *src = (const char*)spsc_queue_read(&q->ring, sizeof(frame));
+
+    // The writer commits whole frames.
+    memcpy(&frame, src, sizeof(frame));
+
+    if (likely(frame.type == SPSC_ELASTIC_FRAME_DATA))
+    {
+      memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+      spsc_queue_read_commit(&q->ring, spsc_elastic_stride(frame.size));
+      return frame.size;
+    }
+
+    struct spsc_queue old = q->ring;
+    char ring_name[NAME_MAX];
+
+    // The next ring exists, the writer created it before the marker. The
+    // old ring is detached so that opening the new one does not unmap it.
+    spsc_queue_init(&q->ring);
+
+    if (unlikely(spsc_elastic_open_ring(q, q->epoch + 1, 0)))
+    {
+      q->ring = old;
+      return (size_t)-1;
+    }
+
+    sq_store_once(q->control->read_epoch, q->epoch);
+
+    spsc_queue_read_commit(&old, spsc_elastic_stride(0));
+    spsc_elastic_close_ring(&old);
+
+    if (!spsc_elastic_ring_name(ring_name, q->name, q->epoch - 1))
+      shm_unlink(ring_name);
+  }
+}
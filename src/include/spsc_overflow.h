@@ -0,0 +1,396 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Full-queue policies for a framed spsc_queue.
+//
+// Records written through this interface are prefixed with a struct
+// spsc_overflow_frame and padded to a multiple of 8 bytes. Every data
+// record carries a sequence number, which lets the reader detect records
+// which were dropped or overwritten by the writer.
+
+enum spsc_overflow_policy
+{
+  // Wait for space, like spsc_queue_write().
+  SPSC_OVERFLOW_BLOCK,
+  // Discard the record which does not fit.
+  SPSC_OVERFLOW_DROP_NEWEST,
+  // Discard the oldest records until the new one fits.
+  SPSC_OVERFLOW_OVERWRITE_OLDEST,
+  // Append records to a file backed overflow queue until the reader
+  // has caught up. Records are dropped if the overflow queue is full.
+  SPSC_OVERFLOW_SPILL,
+};
+
+enum spsc_overflow_frame_type
+{
+  SPSC_OVERFLOW_FRAME_DATA,
+  // In the ring: the following records are in the spill queue.
+  SPSC_OVERFLOW_FRAME_SPILL,
+  // In the spill queue: the following records are in the ring.
+  SPSC_OVERFLOW_FRAME_RETURN,
+};
+
+struct spsc_overflow_frame
+{
+  uint32_t size;
+  uint32_t type;
+  uint64_t seq;
+};
+
+#define SPSC_OVERFLOW_ALIGN 8
+
+struct spsc_overflow_queue
+{
+  struct spsc_queue ring;
+  struct spsc_queue spill;
+  enum spsc_overflow_policy policy;
+
+  // Writer state.
+  uint64_t write_seq;
+  // Number of records dropped or overwritten by the writer.
+  uint64_t dropped;
+  int spilling;
+
+  // Reader state.
+  uint64_t read_seq;
+  // Number of records the reader has found missing in the sequence.
+  uint64_t lost;
+  int draining;
+};
+
+static inline void spsc_overflow_init(struct spsc_overflow_queue *q, enum spsc_overflow_policy policy)
+{
+  spsc_queue_init(&q->ring);
+  spsc_queue_init(&q->spill);
+  q->policy = policy;
+  q->write_seq = 0;
+  q->dropped = 0;
+  q->spilling = 0;
+  q->read_seq = 0;
+  q->lost = 0;
+  q->draining = 0;
+}
+
+static inline void spsc_overflow_free(struct spsc_overflow_queue *q)
+{
+  spsc_queue_free(&q->ring);
+  spsc_queue_free(&q->spill);
+}
+
+static inline int spsc_overflow_alloc_anonymous(struct spsc_overflow_queue *q, size_t size)
+{
+  return spsc_queue_alloc_anonymous(&q->ring, size);
+}
+
+// Attach the spill queue to a file laid out like a named queue (see
+// spsc_queue_shm_size()). Both reader and writer have to attach the same
+// file.
+static inline int spsc_overflow_spill_fdopen(struct spsc_overflow_queue *q, int fd)
+{
+  return spsc_queue_fdopen(&q->spill, fd);
+}
+
+// Create an overflow file from a mkstemp() template and attach it as the
+// spill queue. The file is unlinked, so the mapping has to be shared
+// through fork().
+static inline int spsc_overflow_spill_create(struct spsc_overflow_queue *q, size_t size,
+                                             char *filename_template)
+{
+  int status = -1;
+  int fd = mkstemp(filename_template);
+
+  if (unlikely(fd < 0))
+    return status;
+
+  do
+  {
+    if (unlikely(ftruncate(fd, spsc_queue_shm_size(size))))
+      break;
+
+    status = spsc_overflow_spill_fdopen(q, fd);
+  }
+  while (0);
+
+  close(fd);
+  unlink(filename_template);
+
+  return status;
+}
+
+static inline size_t spsc_overflow_stride(size_t size)
+{
+  size += sizeof(struct spsc_overflow_frame);
+  return (size + (SPSC_OVERFLOW_ALIGN - 1)) & ~(size_t)(SPSC_OVERFLOW_ALIGN - 1);
+}
+
+static inline void spsc_overflow_put(void *dst, uint32_t type, uint64_t seq, const void *src, size_t size)
+{
+  struct spsc_overflow_frame frame = { (uint32_t)size, type, seq };
+
+  memcpy(dst, &frame, sizeof(frame));
+  if (size)
+    memcpy((char*)dst + sizeof(frame), src, size);
+}
+
+static inline void spsc_overflow_put_marker(struct spsc_queue *q, uint32_t type)
+{
+  const size_t stride = spsc_overflow_stride(0);
+  // Space for the marker is always kept free, see spsc_overflow_write_spill().
+  void *dst = spsc_queue_try_write(q, stride);
+
+  assert(dst);
+  spsc_overflow_put(dst, type, 0, NULL, 0);
+  spsc_queue_write_commit(q, stride);
+}
+
+static inline void * spsc_overflow_try_reserve(struct spsc_queue *q, size_t size)
+{
+  if (unlikely(size > spsc_queue_capacity(q)))
+    return NULL;
+
+  return spsc_queue_try_write(q, size);
+}
+
+static inline int spsc_overflow_try_put(struct spsc_queue *q, uint64_t seq, const void *src,
+                                        size_t size, size_t reserve)
+{
+  size_t stride = spsc_overflow_stride(size);
+  void *dst = spsc_overflow_try_reserve(q, stride + reserve);
+
+  if (dst == NULL)
+    return 0;
+
+  spsc_overflow_put(dst, SPSC_OVERFLOW_FRAME_DATA, seq, src, size);
+  spsc_queue_write_commit(q, stride);
+
+  return 1;
+}
+
+static inline int spsc_overflow_write_spill(struct spsc_overflow_queue *q, uint64_t seq,
+                                            const void *src, size_t size)
+{
+  // Both ring and spill queue always keep room for one marker, so that
+  // switching between them never has to wait.
+  const size_t marker = spsc_overflow_stride(0);
+
+  if (!q->spilling)
+  {
+    if (likely(spsc_overflow_try_put(&q->ring, seq, src, size, marker)))
+      return 1;
+
+    if (unlikely(q->spill.header == MAP_FAILED) ||
+        !spsc_overflow_try_reserve(&q->spill, spsc_overflow_stride(size) + marker))
+      return 0;
+
+    spsc_overflow_put_marker(&q->ring, SPSC_OVERFLOW_FRAME_SPILL);
+    q->spilling = 1;
+  }
+  else if (spsc_overflow_try_reserve(&q->ring, spsc_overflow_stride(size) + marker))
+  {
+    spsc_overflow_put_marker(&q->spill, SPSC_OVERFLOW_FRAME_RETURN);
+    q->spilling = 0;
+    return spsc_overflow_try_put(&q->ring, seq, src, size, marker);
+  }
+
+  return spsc_overflow_try_put(&q->spill, seq, src, size, marker);
+}
+
+static inline int spsc_overflow_write_overwrite(struct spsc_overflow_queue *q, uint64_t seq,
+                                                const void *src, size_t size)
+{
+  struct spsc_queue *ring = &q->ring;
+  size_t stride = spsc_overflow_stride(size);
+  uint32_t write_offset = sq_read_once(ring->header->write_offset);
+
+  if (unlikely(stride > spsc_queue_capacity(ring)))
+    return 0;
+
+  while (1)
+  {
+    uint32_t read_offset = sq_read_once(ring->header->read_offset);
+    struct spsc_overflow_frame frame;
+
+    if (likely(spsc_queue_capacity(ring) >= (write_offset - read_offset) + stride))
+      break;
+
+    // The oldest frame was written by us, so its header is stable. The
+    // reader may have consumed it in the meantime, in which case the
+    // exchange fails and we look again.
+    memcpy(&frame, circular_area_get_pointer(&ring->area, read_offset), sizeof(frame));
+
+    if (sq_compare_exchange(ring->header->read_offset, read_offset,
+                            read_offset + (uint32_t)spsc_overflow_stride(frame.size)))
+      q->dropped++;
+  }
+
+  spsc_overflow_put(circular_area_get_pointer(&ring->area, write_offset),
+                    SPSC_OVERFLOW_FRAME_DATA, seq, src, size);
+  spsc_queue_write_commit(ring, stride);
+
+  return 1;
+}
+
+// Writes one record according to the queue policy. Returns 1 if the
+// record was queued and 0 if it was dropped. Only SPSC_OVERFLOW_BLOCK
+// ever waits, and it drops records which would never fit into the ring
+// instead of waiting forever.
+static inline int spsc_overflow_write_from(struct spsc_overflow_queue *q, const void *src, size_t size)
+{
+  uint64_t seq = q->write_seq++;
+  int status;
+
+  switch (q->policy)
+  {
+  case SPSC_OVERFLOW_BLOCK:
+    {
+      size_t stride = spsc_overflow_stride(size);
+
+      if (unlikely(stride > spsc_queue_capacity(&q->ring)))
+      {
+        status = 0;
+        break;
+      }
+
+      void *dst = spsc_queue_write(&q->ring, stride);
+
+      spsc_overflow_put(dst, SPSC_OVERFLOW_FRAME_DATA, seq, src, size);
+      spsc_queue_write_commit(&q->ring, stride);
+      return 1;
+    }
+  case SPSC_OVERFLOW_DROP_NEWEST:
+    status = spsc_overflow_try_put(&q->ring, seq, src, size, 0);
+    break;
+  case SPSC_OVERFLOW_OVERWRITE_OLDEST:
+    return spsc_overflow_write_overwrite(q, seq, src, size);
+  case SPSC_OVERFLOW_SPILL:
+    status = spsc_overflow_write_spill(q, seq, src, size);
+    break;
+  default:
+    status = 0;
+  }
+
+  if (unlikely(!status))
+    q->dropped++;
+
+  return status;
+}
+
+static inline void spsc_overflow_account(struct spsc_overflow_queue *q, uint64_t seq)
+{
+  q->lost += seq - q->read_seq;
+  q->read_seq = seq + 1;
+}
+
+// Reads one frame in overwrite mode. The writer may move read_offset
+// forward underneath us, so the record is copied out first and the copy
+// is only accepted if read_offset was still unchanged afterwards.
+static inline int spsc_overflow_read_overwrite(struct spsc_overflow_queue *q, void *dst, size_t max,
+                                               size_t *size, int wait)
+{
+  struct spsc_queue *ring = &q->ring;
+
+  while (1)
+  {
+    uint32_t read_offset = sq_read_once(ring->header->read_offset);
+    uint32_t write_offset = sq_read_once(ring->header->write_offset);
+    struct spsc_overflow_frame frame;
+    size_t stride;
+
+    if (write_offset == read_offset)
+    {
+      if (!wait)
+        return 0;
+      spsc_queue_read(ring, sizeof(frame));
+      continue;
+    }
+
+    sq_thread_fence_acquire();
+
+    const char *src = (const char*)circular_area_get_pointer(&ring->area, read_offset);
+
+    memcpy(&frame, src, sizeof(frame));
+    stride = spsc_overflow_stride(frame.size);
+
+    // A torn header is detected by the exchange below.
+    if (likely(stride <= write_offset - read_offset))
+      memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+
+    if (!sq_compare_exchange(ring->header->read_offset, read_offset, read_offset + (uint32_t)stride))
+      continue;
+
+    spsc_overflow_account(q, frame.seq);
+    *size = frame.size;
+    return 1;
+  }
+}
+
+static inline int spsc_overflow_read_frame(struct spsc_overflow_queue *q, void *dst, size_t max,
+                                           size_t *size, int wait)
+{
+  while (1)
+  {
+    struct spsc_queue *src_queue = q->draining ? &q->spill : &q->ring;
+    struct spsc_overflow_frame frame;
+    const char *src;
+
+    if (wait)
+      src = (const char*)spsc_queue_read(src_queue, sizeof(frame));
+    else
+      src = (const char*)spsc_queue_try_read(src_queue, sizeof(frame));
+
+    if (src == NULL)
+      return 0;
+
+    // The writer commits whole frames, so the payload is available too.
+    memcpy(&frame, src, sizeof(frame));
+
+    switch (frame.type)
+    {
+    case SPSC_OVERFLOW_FRAME_SPILL:
+      q->draining = 1;
+      break;
+    case SPSC_OVERFLOW_FRAME_RETURN:
+      q->draining = 0;
+      break;
+    default:
+      memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+      spsc_overflow_account(q, frame.seq);
+      *size = frame.size;
+    }
+
+    spsc_queue_read_commit(src_queue, spsc_overflow_stride(frame.size));
+
+    if (frame.type == SPSC_OVERFLOW_FRAME_DATA)
+      return 1;
+  }
+}
+
+// Reads the next record into dst, waiting if the queue is empty. Returns
+// the size of the record, of which at most max bytes are copied. Records
+// missing from the sequence are added to q->lost.
+static inline size_t spsc_overflow_read_to(struct spsc_overflow_queue *q, void *dst, size_t max)
+{
+  size_t size = 0;
+
+  if (q->policy == SPSC_OVERFLOW_OVERWRITE_OLDEST)
+    spsc_overflow_read_overwrite(q, dst, max, &size, 1);
+  else
+    spsc_overflow_read_frame(q, dst, max, &size, 1);
+
+  return size;
+}
+
+// Like spsc_overflow_read_to() but returns 0 instead of waiting when the
+// queue is empty.
+static inline int spsc_overflow_try_read_to(struct spsc_overflow_queue *q, void *dst, size_t max,
+                                            size_t *size)
+{
+  if (q->policy == SPSC_OVERFLOW_OVERWRITE_OLDEST)
+    return spsc_overflow_read_overwrite(q, dst, max, size, 0);
+
+  return spsc_overflow_read_frame(q, dst, max, size, 0);
+}
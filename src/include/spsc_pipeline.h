@@ -0,0 +1,271 @@
+#pragma once
+
+#include "barriers.h"
+#include "circular_area.h"
+#include "futex.h"
+#include "port.h"
+#include "shared_alloc.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Ring with one writer and a chain of processing stages.
+//
+// All stages work on the same circular_area. Cursor 0 belongs to the writer,
+// cursors 1 to stages belong to the stages in order. Stage k may only read
+// data which stage k-1 has committed and may modify it in place. The writer
+// may only reuse space which the last stage has committed. Each stage waits
+// on the cursor of its predecessor, the writer on the cursor of the last
+// stage, using the same futex handshake as spsc_queue.
+
+#define SPSC_PIPELINE_MAX_STAGES 15
+
+struct spsc_pipeline_cursor
+{
+  // Offset up to which the owner of this cursor has committed.
+  SQ_ATOMIC(uint32_t) offset;
+  uint32_t reserved;
+  // When the owner is waiting for its predecessor, this variable
+  // contains the number of bytes it would like to process.
+  SQ_ATOMIC(size_t) wait_size;
+  // Keep cursors on separate cache lines.
+  char padding[64 - 2 * sizeof(size_t)];
+};
+
+struct spsc_pipeline_header
+{
+  struct spsc_pipeline_cursor cursors[SPSC_PIPELINE_MAX_STAGES + 1];
+  uint32_t stages;
+};
+
+struct spsc_pipeline
+{
+  struct spsc_pipeline_header *header;
+  struct circular_area area;
+};
+
+static inline void spsc_pipeline_init(struct spsc_pipeline *p)
+{
+  p->header = (struct spsc_pipeline_header*)MAP_FAILED;
+  circular_area_init(&p->area);
+}
+
+static inline void spsc_pipeline_free(struct spsc_pipeline *p)
+{
+  shared_alloc_free(p->header, sizeof(*p->header));
+  circular_area_free(&p->area);
+}
+
+static inline size_t spsc_pipeline_capacity(const struct spsc_pipeline *p)
+{
+  return p->area.size;
+}
+
+static inline unsigned int spsc_pipeline_stages(const struct spsc_pipeline *p)
+{
+  return p->header->stages;
+}
+
+static inline int spsc_pipeline_alloc_anonymous(struct spsc_pipeline *p, size_t size, unsigned int stages)
+{
+  struct spsc_pipeline_header *header;
+
+  if (unlikely(!stages || stages > SPSC_PIPELINE_MAX_STAGES))
+    return -1;
+
+  header = (struct spsc_pipeline_header*)shared_alloc_anonymous(sizeof(struct spsc_pipeline_header));
+
+  if (unlikely(header == MAP_FAILED))
+    return -1;
+
+  int status = circular_area_allocate_shared_anonymous(&p->area, size);
+
+  if (unlikely(status))
+  {
+    shared_alloc_free(header, sizeof(*header));
+  }
+  else
+  {
+    header->stages = stages;
+    p->header = header;
+  }
+
+  return status;
+}
+
+static inline off_t spsc_pipeline_shm_size(size_t size)
+{
+  return (off_t)(shared_alloc_round_up(sizeof(struct spsc_pipeline_header)) + shared_alloc_round_up(size));
+}
+
+// Maps a pipeline from a file of spsc_pipeline_shm_size() bytes. The
+// number of stages is set by whoever creates the file, when it is 0.
+static inline int spsc_pipeline_fdopen(struct spsc_pipeline *p, int fd, unsigned int stages)
+{
+  struct stat statbuf;
+  size_t header_size = shared_alloc_round_up(sizeof(struct spsc_pipeline_header));
+  struct spsc_pipeline_header *header;
+
+  if (unlikely(!stages || stages > SPSC_PIPELINE_MAX_STAGES))
+    return -1;
+
+  if (unlikely(fstat(fd, &statbuf) || (size_t)statbuf.st_size <= header_size))
+    return -1;
+
+  header = (struct spsc_pipeline_header*)shared_alloc_mmap(sizeof(struct spsc_pipeline_header), fd, 0);
+
+  if (unlikely(header == MAP_FAILED))
+    return -1;
+
+  if (unlikely(circular_area_mmap(&p->area, statbuf.st_size - header_size, fd, header_size)))
+  {
+    shared_alloc_free(header, sizeof(*header));
+    return -1;
+  }
+
+  if (!header->stages)
+    header->stages = stages;
+
+  if (unlikely(header->stages != stages))
+  {
+    shared_alloc_free(header, sizeof(*header));
+    circular_area_free(&p->area);
+    return -1;
+  }
+
+  p->header = header;
+
+  return 0;
+}
+
+// Bytes available to the owner of cursor index (0 for the writer).
+static inline size_t spsc_pipeline_available(const struct spsc_pipeline *p, unsigned int index)
+{
+  const struct spsc_pipeline_cursor *cursors = p->header->cursors;
+
+  if (index == 0)
+  {
+    uint32_t write_offset = sq_read_once(cursors[0].offset);
+    uint32_t last_offset = sq_read_once(cursors[p->header->stages].offset);
+
+    return p->area.size - (write_offset - last_offset);
+  }
+
+  return sq_read_once(cursors[index - 1].offset) - sq_read_once(cursors[index].offset);
+}
+
+static inline unsigned int spsc_pipeline_waits_on(const struct spsc_pipeline *p, unsigned int index)
+{
+  return index ? index - 1 : p->header->stages;
+}
+
+static inline void * spsc_pipeline_try_acquire(struct spsc_pipeline *p, unsigned int index, size_t size)
+{
+  assert(size <= p->area.size);
+
+  if (unlikely(spsc_pipeline_available(p, index) < size))
+    return NULL;
+
+  sq_thread_fence_acquire();
+
+  return circular_area_get_pointer(&p->area, sq_read_once(p->header->cursors[index].offset));
+}
+
+static inline void * spsc_pipeline_acquire(struct spsc_pipeline *p, unsigned int index, size_t size)
+{
+  struct spsc_pipeline_cursor *self = &p->header->cursors[index];
+  struct spsc_pipeline_cursor *pred = &p->header->cursors[spsc_pipeline_waits_on(p, index)];
+
+  assert(size <= p->area.size);
+
+  while (1)
+  {
+    uint32_t pred_offset = sq_read_once(pred->offset);
+
+    if (unlikely(spsc_pipeline_available(p, index) < size))
+    {
+      sq_store_once(self->wait_size, size);
+      futex_wait(&pred->offset, pred_offset);
+      continue;
+    }
+
+    sq_thread_fence_acquire();
+
+    return circular_area_get_pointer(&p->area, sq_read_once(self->offset));
+  }
+}
+
+static inline void spsc_pipeline_commit(struct spsc_pipeline *p, unsigned int index, size_t size)
+{
+  unsigned int stages = p->header->stages;
+  // The cursor which waits on this one.
+  unsigned int next = index == stages ? 0 : index + 1;
+  struct spsc_pipeline_cursor *self = &p->header->cursors[index];
+  struct spsc_pipeline_cursor *succ = &p->header->cursors[next];
+
+  sq_thread_fence_release();
+  uint32_t offset = sq_fetch_add_once(self->offset, (uint32_t)size);
+  sq_thread_fence_acquire();
+  uint32_t succ_offset = sq_read_once(succ->offset);
+  size_t wait_size = sq_read_once(succ->wait_size);
+  size_t available = next ? offset - succ_offset : p->area.size - (succ_offset - offset);
+
+  if (unlikely(available < wait_size))
+  {
+    futex_wake(&self->offset, 1);
+  }
+}
+
+static inline void * spsc_pipeline_write(struct spsc_pipeline *p, size_t size)
+{
+  return spsc_pipeline_acquire(p, 0, size);
+}
+
+static inline void * spsc_pipeline_try_write(struct spsc_pipeline *p, size_t size)
+{
+  return spsc_pipeline_try_acquire(p, 0, size);
+}
+
+static inline void spsc_pipeline_write_commit(struct spsc_pipeline *p, size_t size)
+{
+  spsc_pipeline_commit(p, 0, size);
+}
+
+static inline void spsc_pipeline_write_from(struct spsc_pipeline *p, const void *src, size_t size)
+{
+  void *dst = spsc_pipeline_write(p, size);
+
+  memcpy(dst, src, size);
+
+  spsc_pipeline_write_commit(p, size);
+}
+
+// Waits until size bytes have been committed by the previous stage and
+// returns a pointer to them, which may be modified in place. Stages are
+// numbered from 1.
+static inline void * spsc_pipeline_stage(struct spsc_pipeline *p, unsigned int stage, size_t size)
+{
+  assert(stage >= 1 && stage <= p->header->stages);
+
+  return spsc_pipeline_acquire(p, stage, size);
+}
+
+static inline void * spsc_pipeline_try_stage(struct spsc_pipeline *p, unsigned int stage, size_t size)
+{
+  assert(stage >= 1 && stage <= p->header->stages);
+
+  return spsc_pipeline_try_acquire(p, stage, size);
+}
+
+// Passes size bytes on to the next stage, or back to the writer after
+// the last stage.
+static inline void spsc_pipeline_stage_commit(struct spsc_pipeline *p, unsigned int stage, size_t size)
+{
+  assert(stage >= 1 && stage <= p->header->stages);
+
+  spsc_pipeline_commit(p, stage, size);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Shared buffer pool for passing large payloads by reference.
+//
+// The pool is a fixed number of equally sized buffers in one shared
+// mapping. The producer acquires a free buffer, fills it and sends a small
+// struct spsc_pool_desc through a regular spsc_queue. The consumer reads
+// the payload in place and hands the buffer back through the return ring
+// of the pool, which contains the indices of all free buffers. The
+// producer is the reader of the return ring and the consumer its writer.
+//
+// Producer:
+//
+//   uint32_t index;
+//   void *buf = spsc_pool_acquire(&pool, &index);
+//   ... fill buf ...
+//   spsc_pool_send(&q, &pool, index, length);
+//
+// Consumer:
+//
+//   struct spsc_pool_desc desc;
+//   const void *buf = spsc_pool_receive(&q, &pool, &desc);
+//   ... use buf ...
+//   spsc_pool_release(&pool, &desc);
+
+struct spsc_pool_desc
+{
+  uint32_t pool_id;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct spsc_pool
+{
+  uint32_t id;
+  uint32_t count;
+  size_t buffer_size;
+  char *base;
+  // Indices of free buffers.
+  struct spsc_queue free_ring;
+};
+
+static inline void spsc_pool_init(struct spsc_pool *pool)
+{
+  pool->id = 0;
+  pool->count = 0;
+  pool->buffer_size = 0;
+  pool->base = (char*)MAP_FAILED;
+  spsc_queue_init(&pool->free_ring);
+}
+
+static inline size_t spsc_pool_mapping_size(const struct spsc_pool *pool)
+{
+  return pool->buffer_size * pool->count;
+}
+
+static inline void spsc_pool_free(struct spsc_pool *pool)
+{
+  pool->base = (char*)shared_alloc_free(pool->base, spsc_pool_mapping_size(pool));
+  spsc_queue_free(&pool->free_ring);
+}
+
+// Allocates count buffers of at least buffer_size bytes each. Buffers are
+// cache line aligned. The pool has to be shared through fork().
+static inline int spsc_pool_alloc_anonymous(struct spsc_pool *pool, uint32_t id, size_t buffer_size,
+                                            uint32_t count)
+{
+  size_t ring_size = (size_t)getpagesize();
+
+  while (ring_size < count * sizeof(uint32_t))
+    ring_size *= 2;
+
+  pool->id = id;
+  pool->count = count;
+  pool->buffer_size = (buffer_size + 63) & ~(size_t)63;
+  pool->base = (char*)shared_alloc_anonymous(spsc_pool_mapping_size(pool));
+
+  if (unlikely(pool->base == MAP_FAILED))
+    return -1;
+
+  if (unlikely(spsc_queue_alloc_anonymous(&pool->free_ring, ring_size)))
+  {
+    pool->base = (char*)shared_alloc_free(pool->base, spsc_pool_mapping_size(pool));
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+    spsc_queue_write_from(&pool->free_ring, &i, sizeof(i));
+
+  return 0;
+}
+
+static inline void * spsc_pool_buffer(const struct spsc_pool *pool, uint32_t index)
+{
+  return pool->base + (size_t)index * pool->buffer_size;
+}
+
+// Producer: waits for a free buffer.
+static inline void * spsc_pool_acquire(struct spsc_pool *pool, uint32_t *index)
+{
+  spsc_queue_read_to(&pool->free_ring, index, sizeof(*index));
+
+  return spsc_pool_buffer(pool, *index);
+}
+
+// Producer: returns NULL if all buffers are in use.
+static inline void * spsc_pool_try_acquire(struct spsc_pool *pool, uint32_t *index)
+{
+  if (!spsc_queue_try_read_to(&pool->free_ring, index, sizeof(*index)))
+    return NULL;
+
+  return spsc_pool_buffer(pool, *index);
+}
+
+// Producer: passes length bytes of buffer index to the consumer.
+static inline void spsc_pool_send(struct spsc_queue *q, const struct spsc_pool *pool, uint32_t index,
+                                  size_t length)
+{
+  struct spsc_pool_desc desc;
+
+  assert(length <= pool->buffer_size);
+
+  desc.pool_id = pool->id;
+  desc.reserved = 0;
+  desc.offset = (uint64_t)index * pool->buffer_size;
+  desc.length = length;
+
+  spsc_queue_write_from(q, &desc, sizeof(desc));
+}
+
+// Consumer: waits for the next descriptor and returns a pointer to the
+// payload. The buffer stays valid until spsc_pool_release() is called.
+static inline const void * spsc_pool_receive(struct spsc_queue *q, const struct spsc_pool *pool,
+                                             struct spsc_pool_desc *desc)
+{
+  spsc_queue_read_to(q, desc, sizeof(*desc));
+
+  assert(desc->pool_id == pool->id);
+  assert(desc->offset + desc->length <= spsc_pool_mapping_size(pool));
+
+  return pool->base + desc->offset;
+}
+
+// Consumer: hands the buffer back to the producer.
+static inline void spsc_pool_release(struct spsc_pool *pool, const struct spsc_pool_desc *desc)
+{
+  uint32_t index = (uint32_t)(desc->offset / pool->buffer_size);
+
+  spsc_queue_write_from(&pool->free_ring, &index, sizeof(index));
+}
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Queue endpoint with priority lanes.
+//
+// One shared memory segment holds a header page and up to
+// SPSC_PRIORITY_MAX_LANES rings, each of its own size. Lane 0 has the
+// highest priority. The writer picks a lane per record; the reader always
+// takes the next record from the highest priority lane which has data, so
+// a control message never waits behind bulk data in a lower lane, even
+// when that lane is full.
+//
+// To avoid starvation, a lower lane which has data is served once after
+// it was passed over starvation_limit times.
+//
+// All lanes share one futex word. The reader never waits on a single
+// lane, so the lane headers are not used for waking it; instead every
+// writer commit bumps the shared word, and wakes it while the reader is
+// waiting. A writer waiting for space in a full lane still uses the futex
+// of that lane.
+//
+// Records are prefixed with a struct spsc_priority_frame and padded to a
+// multiple of 8 bytes.
+
+#define SPSC_PRIORITY_ALIGN               8
+#define SPSC_PRIORITY_MAX_LANES           8
+#define SPSC_PRIORITY_DEFAULT_STARVATION  64
+
+struct spsc_priority_lane_header
+{
+  struct spsc_header header;
+  char padding[64 - sizeof(struct spsc_header)];
+};
+
+struct spsc_priority_header
+{
+  // Futex word, incremented by writers after every commit.
+  SQ_ATOMIC(uint32_t) seq;
+  // Non-zero while the reader is waiting on seq.
+  SQ_ATOMIC(uint32_t) waiting;
+  uint32_t lanes;
+  uint32_t reserved;
+  uint64_t sizes[SPSC_PRIORITY_MAX_LANES];
+  // The lane headers start on the third cache line.
+  char padding[128 - 16 - 8 * SPSC_PRIORITY_MAX_LANES];
+  struct spsc_priority_lane_header lane[SPSC_PRIORITY_MAX_LANES];
+};
+
+struct spsc_priority_frame
+{
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct spsc_priority
+{
+  struct spsc_priority_header *header;
+  unsigned int lanes;
+  struct spsc_queue lane[SPSC_PRIORITY_MAX_LANES];
+
+  // Reader state.
+  unsigned int starvation_limit;
+  unsigned int skipped[SPSC_PRIORITY_MAX_LANES];
+};
+
+static inline void spsc_priority_init(struct spsc_priority *p)
+{
+  p->header = (struct spsc_priority_header*)MAP_FAILED;
+  p->lanes = 0;
+  p->starvation_limit = SPSC_PRIORITY_DEFAULT_STARVATION;
+
+  for (unsigned int i = 0; i < SPSC_PRIORITY_MAX_LANES; i++)
+  {
+    spsc_queue_init(&p->lane[i]);
+    p->skipped[i] = 0;
+  }
+}
+
+static inline void spsc_priority_free(struct spsc_priority *p)
+{
+  p->header = (struct spsc_priority_header*)shared_alloc_free(p->header, sizeof(*p->header));
+
+  for (unsigned int i = 0; i < p->lanes; i++)
+    circular_area_free(&p->lane[i].area);
+
+  p->lanes = 0;
+}
+
+static inline off_t spsc_priority_shm_size(unsigned int lanes, const size_t *sizes)
+{
+  size_t size = shared_alloc_round_up(sizeof(struct spsc_priority_header));
+
+  for (unsigned int i = 0; i < lanes; i++)
+    size += shared_alloc_round_up(sizes[i]);
+
+  return (off_t)size;
+}
+
+static inline int spsc_priority_map(struct spsc_priority *p, int fd)
+{
+  struct spsc_priority_header *header;
+  size_t offset = shared_alloc_round_up(sizeof(struct spsc_priority_header));
+
+  header = (struct spsc_priority_header*)shared_alloc_mmap(sizeof(struct spsc_priority_header), fd, 0);
+
+  if (unlikely(header == MAP_FAILED))
+    return -1;
+
+  p->header = header;
+
+  if (unlikely(!header->lanes || header->lanes > SPSC_PRIORITY_MAX_LANES))
+  {
+    spsc_priority_free(p);
+    return -1;
+  }
+
+  for (p->lanes = 0; p->lanes < header->lanes; p->lanes++)
+  {
+    struct spsc_queue *q = &p->lane[p->lanes];
+
+    if (unlikely(circular_area_mmap(&q->area, header->sizes[p->lanes], fd, offset)))
+    {
+      spsc_priority_free(p);
+      return -1;
+    }
+
+    q->header = &header->lane[p->lanes].header;
+    offset += header->sizes[p->lanes];
+  }
+
+  return 0;
+}
+
+// Maps an endpoint from a file set up by spsc_priority_alloc_anonymous()
+// or spsc_priority_create().
+static inline int spsc_priority_fdopen(struct spsc_priority *p, int fd)
+{
+  return spsc_priority_map(p, fd);
+}
+
+// Lays out an endpoint with the given number of lanes in the file, which
+// has to be empty. Every size has to be a power of two and a multiple of
+// the page size.
+static inline int spsc_priority_create(struct spsc_priority *p, int fd, unsigned int lanes, const size_t *sizes)
+{
+  struct spsc_priority_header *header;
+
+  if (unlikely(!lanes || lanes > SPSC_PRIORITY_MAX_LANES))
+    return -1;
+
+  if (unlikely(ftruncate(fd, spsc_priority_shm_size(lanes, sizes))))
+    return -1;
+
+  header = (struct spsc_priority_header*)shared_alloc_mmap(sizeof(struct spsc_priority_header), fd, 0);
+
+  if (unlikely(header == MAP_FAILED))
+    return -1;
+
+  header->lanes = lanes;
+  for (unsigned int i = 0; i < lanes; i++)
+    header->sizes[i] = sizes[i];
+
+  shared_alloc_free(header, sizeof(*header));
+
+  return spsc_priority_map(p, fd);
+}
+
+// Allocates an endpoint which has to be shared through fork() or between
+// threads.
+static inline int spsc_priority_alloc_anonymous(struct spsc_priority *p, unsigned int lanes, const size_t *sizes)
+{
+  int fd = memfd_create("spsc_priority", MFD_CLOEXEC);
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  int status = spsc_priority_create(p, fd, lanes, sizes);
+
+  close(fd);
+
+  return status;
+}
+
+static inline size_t spsc_priority_stride(size_t size)
+{
+  size += sizeof(struct spsc_priority_frame);
+  return (size + (SPSC_PRIORITY_ALIGN - 1)) & ~(size_t)(SPSC_PRIORITY_ALIGN - 1);
+}
+
+static inline void spsc_priority_notify(struct spsc_priority *p)
+{
+  struct spsc_priority_header *header = p->header;
+
+  // Bumped unconditionally: a reader which has read seq but not yet
+  // stored waiting must see the change and not go to sleep.
+  sq_fetch_add_once(header->seq, (uint32_t)1);
+  sq_thread_fence_acquire();
+
+  if (unlikely(sq_read_once(header->waiting)))
+    futex_wake(&header->seq, 1);
+}
+
+static inline void spsc_priority_put(struct spsc_priority *p, unsigned int lane, void *dst,
+                                     const void *src, size_t size)
+{
+  struct spsc_priority_frame frame = { (uint32_t)size, 0 };
+  size_t stride = spsc_priority_stride(size);
+
+  memcpy(dst, &frame, sizeof(frame));
+  memcpy((char*)dst + sizeof(frame), src, size);
+
+  spsc_queue_write_commit(&p->lane[lane], stride);
+  spsc_priority_notify(p);
+}
+
+// Writer: waits for space in the lane and writes the record.
+static inline void spsc_priority_write_from(struct spsc_priority *p, unsigned int lane, const void *src, size_t size)
+{
+  assert(lane < p->lanes);
+
+  spsc_priority_put(p, lane, spsc_queue_write(&p->lane[lane], spsc_priority_stride(size)), src, size);
+}
+
+// Writer: writes the record if the lane has space. Returns 1 on success.
+static inline int spsc_priority_try_write_from(struct spsc_priority *p, unsigned int lane, const void *src,
+                                               size_t size)
+{
+  void *dst;
+
+  assert(lane < p->lanes);
+
+  dst = spsc_queue_try_write(&p->lane[lane], spsc_priority_stride(size));
+
+  if (!dst)
+    return 0;
+
+  spsc_priority_put(p, lane, dst, src, size);
+
+  return 1;
+}
+
+// Returns the lane to read from next, or -1 if all lanes are empty.
+static inline int spsc_priority_select(struct spsc_priority *p)
+{
+  int first = -1;
+  int starved = -1;
+
+  for (unsigned int i = 0; i < p->lanes; i++)
+  {
+    if (!spsc_queue_read_size(&p->lane[i]))
+      continue;
+
+    if (first < 0)
+    {
+      first = (int)i;
+      continue;
+    }
+
+    // The highest priority lane among those passed over too often.
+    if (++p->skipped[i] >= p->starvation_limit && starved < 0)
+      starved = (int)i;
+  }
+
+  if (starved >= 0)
+  {
+    // The lane with priority was counted as served nonetheless.
+    p->skipped[starved] = 0;
+    return starved;
+  }
+
+  if (first >= 0)
+    p->skipped[first] = 0;
+
+  return first;
+}
+
+static inline size_t spsc_priority_get(struct spsc_priority *p, unsigned int lane, void *dst, size_t max)
+{
+  struct spsc_queue *q = &p->lane[lane];
+  struct spsc_priority_frame frame;
+  const char *src = (const char*)spsc_queue_try_read(q, sizeof(frame));
+
+  // The writer commits whole frames.
+  sq_thread_fence_acquire();
+  memcpy(&frame, src, sizeof(frame));
+  memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+
+  spsc_queue_read_commit(q, spsc_priority_stride(frame.size));
+
+  return frame.size;
+}
+
+// Reader: takes the next record if any lane has one, copies at most max
+// bytes of it to dst and stores its size in *size and its lane in *lane.
+// Returns 1 if a record was read.
+static inline int spsc_priority_try_read_to(struct spsc_priority *p, unsigned int *lane, void *dst, size_t max,
+                                            size_t *size)
+{
+  int selected = spsc_priority_select(p);
+
+  if (selected < 0)
+    return 0;
+
+  *lane = (unsigned int)selected;
+  *size = spsc_priority_get(p, *lane, dst, max);
+
+  return 1;
+}
+
+// Reader: waits for the next record. Returns its size, of which at most
+// max bytes are copied to dst, and stores its lane in *lane.
+static inline size_t spsc_priority_read_to(struct spsc_priority *p, unsigned int *lane, void *dst, size_t max)
+{
+  struct spsc_priority_header *header = p->header;
+
+  while (1)
+  {
+    uint32_t seq = sq_read_once(header->seq);
+    int selected = spsc_priority_select(p);
+
+    if (likely(selected >= 0))
+    {
+      *lane = (unsigned int)selected;
+      return spsc_priority_get(p, *lane, dst, max);
+    }
+
+    sq_store_once(header->waiting, (uint32_t)1);
+    sq_thread_fence_acquire();
+
+    if (sq_read_once(header->seq) == seq && spsc_priority_select(p) < 0)
+      futex_wait(&header->seq, seq);
+
+    sq_store_once(header->waiting, (uint32_t)0);
+  }
+}
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 struct spsc_header
@@ -41,9 +42,22 @@ static inline void spsc_queue_init(struct spsc_queue *q)
   circular_area_init(&q->area);
 }
 
+// Flags for spsc_queue_alloc_anonymous_flags() and
+// spsc_queue_fdopen_flags().
+enum spsc_queue_flags
+{
+  // Fault in all pages up front.
+  SPSC_QUEUE_POPULATE = 1,
+  // Lock all pages into memory.
+  SPSC_QUEUE_MLOCK = 2,
+  // Map the queue read-only, for observers which neither read nor write.
+  SPSC_QUEUE_READONLY = 4,
+};
+
 static inline void spsc_queue_free(struct spsc_queue *q)
 {
-  shared_alloc_free(q->header, sizeof(*q->header));
+  q->header = (struct spsc_header*)shared_alloc_free(q->header, sizeof(*q->header));
+  circular_area_free(&q->area);
 }
 
 static inline size_t spsc_queue_capacity(const struct spsc_queue *q)
@@ -51,74 +65,88 @@ static inline size_t spsc_queue_capacity(const struct spsc_queue *q)
   return q->area.size;
 }
 
-static inline int spsc_queue_alloc_anonymous(struct spsc_queue *q, size_t size)
-{
-  struct spsc_header *header = (struct spsc_header*)shared_alloc_anonymous(sizeof(struct spsc_header));
-
-  if (unlikely(header == MAP_FAILED))
-    return -1;
-
-  int status = circular_area_allocate_shared_anonymous(&q->area, size);
-
-  if (unlikely(status))
-  {
-    shared_alloc_free(header, sizeof(*header));
-  }
-  else
-  {
-    q->header = header;
-  }
+static inline off_t spsc_queue_shm_size(size_t size) {
+  size_t page_size = (size_t)getpagesize();
 
-  return status;
+  return (off_t)(page_size + shared_alloc_round_up(size));
 }
 
-static inline int spsc_queue_fdopen(struct spsc_queue *q, int fd)
+// Maps header page and ring from a file of spsc_queue_shm_size(size)
+// bytes. Both live in one reserved address range: the header page,
+// directly followed by the two halves of the ring.
+static inline int spsc_queue_mmap(struct spsc_queue *q, size_t size, int fd, int flags)
 {
-  struct stat statbuf;
-  int status = -1;
-  off_t fsize;
-  size_t size;
   size_t page_size = (size_t)getpagesize();
-  struct spsc_header *header = (struct spsc_header*)MAP_FAILED;
+  size_t total = page_size + 2 * size;
+  int mmap_flags = (flags & SPSC_QUEUE_POPULATE) ? MAP_POPULATE : 0;
+  int prot = (flags & SPSC_QUEUE_READONLY) ? PROT_READ : PROT_READ|PROT_WRITE;
+  char *base = (char*)circular_area_reserve(total);
+
+  if (unlikely(base == MAP_FAILED))
+    return -1;
 
   do
   {
-    status = fstat(fd, &statbuf);
-
-    if (status)
+    if (unlikely(mmap(base, page_size, prot, MAP_SHARED|MAP_FIXED|mmap_flags, fd, 0) == MAP_FAILED))
       break;
 
-    fsize = statbuf.st_size;
-
-    if ((size_t)fsize < page_size)
-      return -1;
-
-    size = fsize - page_size;
-
-    header = (struct spsc_header*)shared_alloc_mmap(sizeof(struct spsc_header), fd, 0);
-
-    if (unlikely(header == MAP_FAILED))
+    if (unlikely(circular_area_mmap_fixed(&q->area, base + page_size, size, fd, page_size, prot, mmap_flags)))
       break;
 
-    status = circular_area_mmap(&q->area, size, fd, page_size);
-
-    if (status)
+    if ((flags & SPSC_QUEUE_MLOCK) && unlikely(mlock(base, total)))
       break;
 
-    q->header = header;
+    // spsc_queue_free() unmaps the header page and the area separately,
+    // which together cover the whole range.
+    q->header = (struct spsc_header*)base;
     return 0;
   }
   while (0);
 
-  shared_alloc_free(header, sizeof(struct spsc_header));
+  circular_area_init(&q->area);
+  munmap(base, total);
+
+  return -1;
+}
+
+static inline int spsc_queue_alloc_anonymous_flags(struct spsc_queue *q, size_t size, int flags)
+{
+  int fd = memfd_create("spsc_queue", MFD_CLOEXEC);
+  int status = -1;
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  if (likely(!ftruncate(fd, spsc_queue_shm_size(size))))
+    status = spsc_queue_mmap(q, size, fd, flags);
+
+  close(fd);
 
   return status;
 }
 
-static inline off_t spsc_queue_shm_size(size_t size) {
+static inline int spsc_queue_alloc_anonymous(struct spsc_queue *q, size_t size)
+{
+  return spsc_queue_alloc_anonymous_flags(q, size, 0);
+}
+
+static inline int spsc_queue_fdopen_flags(struct spsc_queue *q, int fd, int flags)
+{
+  struct stat statbuf;
   size_t page_size = (size_t)getpagesize();
 
-  return (off_t)(page_size + shared_alloc_round_up(size));
+  if (unlikely(fstat(fd, &statbuf)))
+    return -1;
+
+  if ((size_t)statbuf.st_size < page_size)
+    return -1;
+
+  return spsc_queue_mmap(q, statbuf.st_size - page_size, fd, flags);
+}
+
+static inline int spsc_queue_fdopen(struct spsc_queue *q, int fd)
+{
+  return spsc_queue_fdopen_flags(q, fd, 0);
 }
 
 static inline void spsc_queue_wake_reader(struct spsc_queue *q)
@@ -184,6 +212,23 @@ static inline const void * spsc_queue_read(struct spsc_queue *q, size_t size)
   return spsc_queue_read_check(q, size, NULL, NULL);
 }
 
+// Like spsc_queue_read() but polls up to spins times before waiting on
+// the futex. The writer does not have to wake a spinning reader.
+static inline const void * spsc_queue_read_spin(struct spsc_queue *q, size_t size, unsigned int spins)
+{
+  for (unsigned int i = 0; i < spins; i++)
+  {
+    const void *src = spsc_queue_try_read(q, size);
+
+    if (likely(src != NULL))
+      return src;
+
+    sq_cpu_relax();
+  }
+
+  return spsc_queue_read(q, size);
+}
+
 static inline void spsc_queue_wait_read(struct spsc_queue *q, size_t size)
 {
   spsc_queue_read(q, size);
@@ -226,6 +271,53 @@ static inline int spsc_queue_try_read_to(struct spsc_queue *q, void *dst, size_t
   return 1;
 }
 
+static inline size_t spsc_iov_size(const struct iovec *iov, int count)
+{
+  size_t size = 0;
+
+  for (int i = 0; i < count; i++)
+    size += iov[i].iov_len;
+
+  return size;
+}
+
+static inline void spsc_queue_scatter(const struct iovec *iov, int count, const void *src)
+{
+  const char *p = (const char*)src;
+
+  for (int i = 0; i < count; i++)
+  {
+    memcpy(iov[i].iov_base, p, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+}
+
+// Reads as many bytes as the fragments hold in total and scatters them
+// into the fragments, with a single commit.
+static inline void spsc_queue_readv(struct spsc_queue *q, const struct iovec *iov, int count)
+{
+  size_t size = spsc_iov_size(iov, count);
+
+  spsc_queue_scatter(iov, count, spsc_queue_read(q, size));
+
+  spsc_queue_read_commit(q, size);
+}
+
+static inline int spsc_queue_try_readv(struct spsc_queue *q, const struct iovec *iov, int count)
+{
+  size_t size = spsc_iov_size(iov, count);
+  const void *src = spsc_queue_try_read(q, size);
+
+  if (src == NULL)
+    return 0;
+
+  spsc_queue_scatter(iov, count, src);
+
+  spsc_queue_read_commit(q, size);
+
+  return 1;
+}
+
 static inline size_t spsc_queue_write_size(const struct spsc_queue *q)
 {
   uint32_t write_offset = sq_read_once(q->header->write_offset);
@@ -304,7 +396,7 @@ static inline void spsc_queue_write_from(struct spsc_queue *q, const void *src,
 
 static inline int spsc_queue_try_write_from(struct spsc_queue *q, const void *src, size_t size)
 {
-  void *dst = spsc_queue_write(q, size);
+  void *dst = spsc_queue_try_write(q, size);
 
   if (dst == NULL)
     return 0;
@@ -314,3 +406,39 @@ static inline int spsc_queue_try_write_from(struct spsc_queue *q, const void *sr
   spsc_queue_write_commit(q, size);
   return 1;
 }
+
+static inline void spsc_queue_gather(void *dst, const struct iovec *iov, int count)
+{
+  char *p = (char*)dst;
+
+  for (int i = 0; i < count; i++)
+  {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+}
+
+// Writes the fragments as one contiguous record, with a single commit
+// and wake check.
+static inline void spsc_queue_writev(struct spsc_queue *q, const struct iovec *iov, int count)
+{
+  size_t size = spsc_iov_size(iov, count);
+
+  spsc_queue_gather(spsc_queue_write(q, size), iov, count);
+
+  spsc_queue_write_commit(q, size);
+}
+
+static inline int spsc_queue_try_writev(struct spsc_queue *q, const struct iovec *iov, int count)
+{
+  size_t size = spsc_iov_size(iov, count);
+  void *dst = spsc_queue_try_write(q, size);
+
+  if (dst == NULL)
+    return 0;
+
+  spsc_queue_gather(dst, iov, count);
+
+  spsc_queue_write_commit(q, size);
+  return 1;
+}
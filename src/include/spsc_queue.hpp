@@ -1,12 +1,187 @@
+#include <initializer_list>
 #include <new>
+#include <type_traits>
 
 #include "spsc_queue.h"
+#include "spsc_record.h"
 
 namespace spsc
 {
+  // Appends fields to a record built in place, see spsc_record.h.
+  class record_writer
+  {
+    struct spsc_record_builder b;
+
+    friend class queue;
+  public:
+    void *reserve(size_t bytes) noexcept
+    {
+      return spsc_record_reserve(&b, bytes);
+    }
+
+    void unreserve(size_t unused) noexcept
+    {
+      spsc_record_unreserve(&b, unused);
+    }
+
+    bool put(const void *src, size_t bytes) noexcept
+    {
+      return spsc_record_put(&b, src, bytes) == 0;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, bool>::type
+    put(const T &value) noexcept
+    {
+      return put(reinterpret_cast<const void*>(&value), sizeof(T));
+    }
+
+    bool put_blob(const void *src, size_t bytes) noexcept
+    {
+      return spsc_record_put_blob(&b, src, bytes) == 0;
+    }
+
+    size_t size() const noexcept
+    {
+      return b.used;
+    }
+
+    bool failed() const noexcept
+    {
+      return b.failed != 0;
+    }
+  };
+
+  // Parses a record in the ring, see spsc_record.h.
+  class record_reader
+  {
+    struct spsc_record_view v;
+
+    friend class queue;
+  public:
+    const void *next(size_t bytes) noexcept
+    {
+      return spsc_record_next(&v, bytes);
+    }
+
+    bool get(void *dst, size_t bytes) noexcept
+    {
+      return spsc_record_get(&v, dst, bytes) == 0;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_trivially_copyable<T>::value, bool>::type
+    get(T &value) noexcept
+    {
+      return get(reinterpret_cast<void*>(&value), sizeof(T));
+    }
+
+    bool get_blob(const void *&src, size_t &bytes) noexcept
+    {
+      return spsc_record_get_blob(&v, &src, &bytes) == 0;
+    }
+
+    size_t size() const noexcept
+    {
+      return v.size;
+    }
+
+    size_t remaining() const noexcept
+    {
+      return spsc_record_remaining(&v);
+    }
+
+    bool failed() const noexcept
+    {
+      return v.failed != 0;
+    }
+  };
+
+  // Fragments for queue::writev() and queue::readv() are either struct
+  // iovec or contiguous ranges like std::span, std::vector or
+  // std::string_view. readv() needs ranges with writable data, which
+  // rules out std::string_view and const containers.
+  inline const void *fragment_data(const struct iovec &f) noexcept
+  {
+    return f.iov_base;
+  }
+
+  inline size_t fragment_size(const struct iovec &f) noexcept
+  {
+    return f.iov_len;
+  }
+
+  template <typename Range>
+  const void *fragment_data(const Range &f) noexcept
+  {
+    return static_cast<const void*>(f.data());
+  }
+
+  template <typename Range>
+  size_t fragment_size(const Range &f) noexcept
+  {
+    return f.size() * sizeof(*f.data());
+  }
+
+  inline void *fragment_target(const struct iovec &f) noexcept
+  {
+    return f.iov_base;
+  }
+
+  inline void *fragment_target(struct iovec &f) noexcept
+  {
+    return f.iov_base;
+  }
+
+  // Taken by non-const reference, so that owning ranges like
+  // std::vector<char> yield their mutable data. Views like std::span<char>
+  // do so even when const.
+  template <typename Range>
+  void *fragment_target(Range &f) noexcept
+  {
+    static_assert(!std::is_const<typename std::remove_pointer<decltype(f.data())>::type>::value,
+                  "readv() fragments must have writable data, e.g. std::vector<char> or std::span<char>");
+    return static_cast<void*>(f.data());
+  }
+
   class queue
   {
     struct spsc_queue q;
+
+    template <typename Fragments>
+    static size_t fragments_size(const Fragments &fragments) noexcept
+    {
+      size_t bytes = 0;
+
+      for (const auto &f : fragments)
+        bytes += fragment_size(f);
+
+      return bytes;
+    }
+
+    template <typename Fragments>
+    static void gather(void *dst, const Fragments &fragments) noexcept
+    {
+      char *p = static_cast<char*>(dst);
+
+      for (const auto &f : fragments)
+      {
+        memcpy(p, fragment_data(f), fragment_size(f));
+        p += fragment_size(f);
+      }
+    }
+
+    template <typename Fragments>
+    static void scatter(Fragments &fragments, const void *src) noexcept
+    {
+      const char *p = static_cast<const char*>(src);
+
+      for (auto &f : fragments)
+      {
+        memcpy(fragment_target(f), p, fragment_size(f));
+        p += fragment_size(f);
+      }
+    }
   public:
     queue(size_t size)
     {
@@ -92,6 +267,66 @@ namespace spsc
       return try_write(reinterpret_cast<const void*>(&value), sizeof(T));
     }
 
+    void writev(const struct iovec *iov, int count) noexcept
+    {
+      spsc_queue_writev(&q, iov, count);
+    }
+
+    bool try_writev(const struct iovec *iov, int count) noexcept
+    {
+      return spsc_queue_try_writev(&q, iov, count);
+    }
+
+    // Writes a range of fragments, e.g. a std::span<const struct iovec> or
+    // a std::array of std::span<const std::byte>, as one record with a
+    // single commit.
+    template <typename Fragments>
+    void writev(const Fragments &fragments) noexcept
+    {
+      size_t bytes = fragments_size(fragments);
+
+      gather(spsc_queue_write(&q, bytes), fragments);
+
+      spsc_queue_write_commit(&q, bytes);
+    }
+
+    template <typename Fragments>
+    bool try_writev(const Fragments &fragments) noexcept
+    {
+      size_t bytes = fragments_size(fragments);
+      void *dst = spsc_queue_try_write(&q, bytes);
+
+      if (dst == nullptr)
+        return false;
+
+      gather(dst, fragments);
+
+      spsc_queue_write_commit(&q, bytes);
+
+      return true;
+    }
+
+    template <typename Fragment>
+    void writev(std::initializer_list<Fragment> fragments) noexcept
+    {
+      writev<std::initializer_list<Fragment>>(fragments);
+    }
+
+    // Builds a record of up to max_bytes in place with f(record_writer&)
+    // and commits the bytes used. Returns false and commits nothing if f
+    // appended more than max_bytes.
+    template <typename Func>
+    bool write_record(size_t max_bytes, Func &&f) noexcept( noexcept(f(std::declval<record_writer&>())) )
+    {
+      record_writer w;
+
+      spsc_record_begin(&w.b, &q, max_bytes);
+
+      f(w);
+
+      return spsc_record_commit(&w.b) == 0;
+    }
+
     void read(void *dst, size_t bytes) noexcept
     {
       spsc_queue_read_to(&q, dst, bytes);
@@ -143,6 +378,69 @@ namespace spsc
       return true;
     }
 
+    void readv(const struct iovec *iov, int count) noexcept
+    {
+      spsc_queue_readv(&q, iov, count);
+    }
+
+    bool try_readv(const struct iovec *iov, int count) noexcept
+    {
+      return spsc_queue_try_readv(&q, iov, count);
+    }
+
+    // Reads as many bytes as the fragments hold and scatters them, with a
+    // single commit. The fragments are taken by forwarding reference, so
+    // that a std::vector<std::vector<char>> is filled in place.
+    template <typename Fragments>
+    void readv(Fragments &&fragments) noexcept
+    {
+      size_t bytes = fragments_size(fragments);
+
+      scatter(fragments, spsc_queue_read(&q, bytes));
+
+      spsc_queue_read_commit(&q, bytes);
+    }
+
+    template <typename Fragments>
+    bool try_readv(Fragments &&fragments) noexcept
+    {
+      size_t bytes = fragments_size(fragments);
+      const void *src = spsc_queue_try_read(&q, bytes);
+
+      if (src == nullptr)
+        return false;
+
+      scatter(fragments, src);
+
+      spsc_queue_read_commit(&q, bytes);
+
+      return true;
+    }
+
+    template <typename Fragment>
+    void readv(std::initializer_list<Fragment> fragments) noexcept
+    {
+      size_t bytes = fragments_size(fragments);
+
+      scatter(fragments, spsc_queue_read(&q, bytes));
+
+      spsc_queue_read_commit(&q, bytes);
+    }
+
+    // Waits for a record built with write_record() and parses it in place
+    // with f(record_reader&).
+    template <typename Func>
+    void read_record(Func &&f) noexcept( noexcept(f(std::declval<record_reader&>())) )
+    {
+      record_reader r;
+
+      spsc_record_read(&q, &r.v);
+
+      f(r);
+
+      spsc_record_read_commit(&q, &r.v);
+    }
+
     ~queue()
     {
       spsc_queue_free(&q);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+
+// Recycles mapped queues of one size.
+//
+// Creating a queue costs a memfd, a reservation and three mappings, and
+// freeing it another round of munmap(). A pool keeps up to max freed
+// queues mapped and hands them out again, so that creating a short-lived
+// queue is a pop from an array.
+//
+// A queue may only be returned to the pool once nobody else uses it: its
+// offsets are reset for the next user, who also sees the stale contents
+// of the ring. Queues shared through fork() must therefore be returned
+// only after the other process has exited or unmapped them.
+
+struct spsc_queue_pool
+{
+  size_t size;
+  int flags;
+  size_t count;
+  size_t max;
+  struct spsc_queue *queues;
+};
+
+static inline void spsc_queue_pool_init(struct spsc_queue_pool *pool)
+{
+  pool->size = 0;
+  pool->flags = 0;
+  pool->count = 0;
+  pool->max = 0;
+  pool->queues = NULL;
+}
+
+// Sets up a pool for queues of size bytes, allocated with the given
+// spsc_queue_flags, of which up to max are kept for reuse.
+static inline int spsc_queue_pool_setup(struct spsc_queue_pool *pool, size_t size, size_t max, int flags)
+{
+  pool->queues = (struct spsc_queue*)calloc(max, sizeof(struct spsc_queue));
+
+  if (unlikely(!pool->queues))
+    return -1;
+
+  pool->size = size;
+  pool->flags = flags;
+  pool->count = 0;
+  pool->max = max;
+
+  return 0;
+}
+
+static inline void spsc_queue_pool_free(struct spsc_queue_pool *pool)
+{
+  while (pool->count)
+    spsc_queue_free(&pool->queues[--pool->count]);
+
+  free(pool->queues);
+  spsc_queue_pool_init(pool);
+}
+
+// Maps queues until count of them are available.
+static inline int spsc_queue_pool_reserve(struct spsc_queue_pool *pool, size_t count)
+{
+  if (count > pool->max)
+    count = pool->max;
+
+  while (pool->count < count)
+  {
+    struct spsc_queue *q = &pool->queues[pool->count];
+
+    spsc_queue_init(q);
+
+    if (unlikely(spsc_queue_alloc_anonymous_flags(q, pool->size, pool->flags)))
+      return -1;
+
+    pool->count++;
+  }
+
+  return 0;
+}
+
+// Takes a queue from the pool, or maps a new one if the pool is empty.
+static inline int spsc_queue_pool_get(struct spsc_queue_pool *pool, struct spsc_queue *q)
+{
+  if (likely(pool->count))
+  {
+    *q = pool->queues[--pool->count];
+    return 0;
+  }
+
+  spsc_queue_init(q);
+
+  return spsc_queue_alloc_anonymous_flags(q, pool->size, pool->flags);
+}
+
+// Returns a queue to the pool, or unmaps it if the pool is full.
+static inline void spsc_queue_pool_put(struct spsc_queue_pool *pool, struct spsc_queue *q)
+{
+  if (unlikely(pool->count == pool->max || spsc_queue_capacity(q) != pool->size))
+  {
+    spsc_queue_free(q);
+    return;
+  }
+
+  sq_store_once(q->header->write_offset, (uint32_t)0);
+  sq_store_once(q->header->write_size, (size_t)0);
+  sq_store_once(q->header->read_offset, (uint32_t)0);
+  sq_store_once(q->header->read_size, (size_t)0);
+
+  pool->queues[pool->count++] = *q;
+  spsc_queue_init(q);
+}
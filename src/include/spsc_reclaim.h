@@ -0,0 +1,77 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Releases the memory of unused ring pages.
+//
+// Once a ring has been filled, all its pages stay resident. For a queue
+// which has gone quiet, spsc_queue_reclaim() punches the free part of the
+// ring out of the shared memory object with MADV_REMOVE, which releases
+// the pages for both halves of the double mapping and for every process
+// mapping the queue. Reclaimed pages read back as zero and are faulted in
+// again when the writer reaches them.
+//
+// Only the writer may call spsc_queue_reclaim(), because only the writer
+// ever touches the free part of the ring. It is meant to be called
+// periodically, for example from a timer in the writer's event loop. As
+// hysteresis, nothing is reclaimed unless the writer has not committed
+// since the previous call and occupancy is at most low_watermark, so busy
+// queues are never touched. The first keep bytes after the write offset
+// stay resident, so that the next writes do not fault.
+
+struct spsc_reclaim
+{
+  size_t low_watermark;
+  size_t keep;
+
+  uint32_t last_write_offset;
+  // The free part of the ring up to this offset has been reclaimed.
+  uint32_t reclaimed_end;
+  int valid;
+};
+
+static inline void spsc_reclaim_init(struct spsc_reclaim *r, size_t low_watermark, size_t keep)
+{
+  r->low_watermark = low_watermark;
+  r->keep = keep;
+  r->last_write_offset = 0;
+  r->reclaimed_end = 0;
+  r->valid = 0;
+}
+
+// Returns the number of bytes released.
+static inline size_t spsc_queue_reclaim(struct spsc_queue *q, struct spsc_reclaim *r)
+{
+  size_t page_size = (size_t)getpagesize();
+  uint32_t write_offset = sq_read_once(q->header->write_offset);
+  uint32_t read_offset = sq_read_once(q->header->read_offset);
+
+  if (!r->valid || write_offset != r->last_write_offset)
+  {
+    r->last_write_offset = write_offset;
+    r->valid = 1;
+    return 0;
+  }
+
+  if ((size_t)(write_offset - read_offset) > r->low_watermark)
+    return 0;
+
+  uint32_t mask = ~(uint32_t)(page_size - 1);
+  uint32_t start = (uint32_t)(write_offset + r->keep + page_size - 1) & mask;
+  uint32_t end = (uint32_t)(read_offset + q->area.size) & mask;
+
+  // Skip what has been reclaimed before.
+  if ((int32_t)(r->reclaimed_end - start) > 0)
+    start = r->reclaimed_end;
+
+  if ((int32_t)(end - start) <= 0)
+    return 0;
+
+  // The free range is contiguous in the double mapping.
+  if (unlikely(madvise(circular_area_get_pointer(&q->area, start), end - start, MADV_REMOVE)))
+    return 0;
+
+  r->reclaimed_end = end;
+
+  return end - start;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Records built in place in the ring.
+//
+// spsc_record_begin() reserves space for a record of up to max bytes with
+// spsc_queue_write(). Fields are appended straight into the ring, and
+// spsc_record_commit() commits only the bytes used, so a record of
+// unknown size needs neither a staging buffer nor a second copy.
+//
+// Each record is prefixed with a struct spsc_record_frame holding its
+// size and padded to a multiple of 8 bytes. On the reader side
+// spsc_record_read() returns a view over the record in the ring, which
+// is parsed field by field in the order the fields were written. Blobs
+// and strings are returned as pointers into the ring, valid until
+// spsc_record_read_commit().
+//
+// Fields are stored unaligned in host byte order. Appending past max or
+// reading past the end of a record fails and marks the builder or view;
+// a failed builder commits nothing.
+
+#define SPSC_RECORD_ALIGN 8
+
+struct spsc_record_frame
+{
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct spsc_record_builder
+{
+  struct spsc_queue *q;
+  char *data;
+  size_t used;
+  size_t max;
+  // Size of the last reservation, which spsc_record_unreserve() may
+  // shorten.
+  size_t last;
+  int failed;
+};
+
+struct spsc_record_view
+{
+  const char *data;
+  size_t size;
+  size_t pos;
+  int failed;
+};
+
+static inline size_t spsc_record_stride(size_t size)
+{
+  size += sizeof(struct spsc_record_frame);
+  return (size + (SPSC_RECORD_ALIGN - 1)) & ~(size_t)(SPSC_RECORD_ALIGN - 1);
+}
+
+static inline void spsc_record_start(struct spsc_record_builder *b, struct spsc_queue *q, void *dst, size_t max)
+{
+  b->q = q;
+  b->data = (char*)dst + sizeof(struct spsc_record_frame);
+  b->used = 0;
+  b->max = max;
+  b->last = 0;
+  b->failed = 0;
+}
+
+// Writer: waits for space for a record of up to max bytes.
+static inline void spsc_record_begin(struct spsc_record_builder *b, struct spsc_queue *q, size_t max)
+{
+  spsc_record_start(b, q, spsc_queue_write(q, spsc_record_stride(max)), max);
+}
+
+// Writer: like spsc_record_begin() but returns 0 if there is no space.
+static inline int spsc_record_try_begin(struct spsc_record_builder *b, struct spsc_queue *q, size_t max)
+{
+  void *dst = spsc_queue_try_write(q, spsc_record_stride(max));
+
+  if (!dst)
+    return 0;
+
+  spsc_record_start(b, q, dst, max);
+
+  return 1;
+}
+
+// Returns space for size bytes at the end of the record, to be filled in
+// place, or NULL if the record would exceed its maximum size.
+static inline void *spsc_record_reserve(struct spsc_record_builder *b, size_t size)
+{
+  char *dst = b->data + b->used;
+
+  if (unlikely(b->failed || size > b->max - b->used))
+  {
+    b->failed = 1;
+    return NULL;
+  }
+
+  b->used += size;
+  b->last = size;
+
+  return dst;
+}
+
+// Gives back the last unused bytes of the last reservation, for fields
+// whose size is only known after they were written.
+static inline void spsc_record_unreserve(struct spsc_record_builder *b, size_t unused)
+{
+  assert(unused <= b->last);
+
+  b->used -= unused;
+  b->last -= unused;
+}
+
+static inline int spsc_record_put(struct spsc_record_builder *b, const void *src, size_t size)
+{
+  void *dst = spsc_record_reserve(b, size);
+
+  if (unlikely(!dst))
+    return -1;
+
+  memcpy(dst, src, size);
+
+  return 0;
+}
+
+static inline int spsc_record_put_u8(struct spsc_record_builder *b, uint8_t value)
+{
+  return spsc_record_put(b, &value, sizeof(value));
+}
+
+static inline int spsc_record_put_u16(struct spsc_record_builder *b, uint16_t value)
+{
+  return spsc_record_put(b, &value, sizeof(value));
+}
+
+static inline int spsc_record_put_u32(struct spsc_record_builder *b, uint32_t value)
+{
+  return spsc_record_put(b, &value, sizeof(value));
+}
+
+static inline int spsc_record_put_u64(struct spsc_record_builder *b, uint64_t value)
+{
+  return spsc_record_put(b, &value, sizeof(value));
+}
+
+static inline int spsc_record_put_double(struct spsc_record_builder *b, double value)
+{
+  return spsc_record_put(b, &value, sizeof(value));
+}
+
+// Appends a blob prefixed with its 32 bit length.
+static inline int spsc_record_put_blob(struct spsc_record_builder *b, const void *src, size_t size)
+{
+  char *dst = (char*)spsc_record_reserve(b, sizeof(uint32_t) + size);
+  uint32_t length = (uint32_t)size;
+
+  if (unlikely(!dst))
+    return -1;
+
+  memcpy(dst, &length, sizeof(length));
+  memcpy(dst + sizeof(length), src, size);
+
+  return 0;
+}
+
+static inline int spsc_record_put_string(struct spsc_record_builder *b, const char *str)
+{
+  return spsc_record_put_blob(b, str, strlen(str));
+}
+
+// Writer: commits the bytes appended so far as one record. Returns -1 and
+// commits nothing if an append failed.
+static inline int spsc_record_commit(struct spsc_record_builder *b)
+{
+  struct spsc_record_frame frame = { (uint32_t)b->used, 0 };
+
+  if (unlikely(b->failed))
+    return -1;
+
+  memcpy(b->data - sizeof(frame), &frame, sizeof(frame));
+  spsc_queue_write_commit(b->q, spsc_record_stride(b->used));
+
+  return 0;
+}
+
+static inline void spsc_record_view_start(struct spsc_record_view *v, const void *src)
+{
+  struct spsc_record_frame frame;
+
+  // The writer commits whole records.
+  sq_thread_fence_acquire();
+  memcpy(&frame, src, sizeof(frame));
+
+  v->data = (const char*)src + sizeof(frame);
+  v->size = frame.size;
+  v->pos = 0;
+  v->failed = 0;
+}
+
+// Reader: waits for the next record and sets up a view over it.
+static inline void spsc_record_read(struct spsc_queue *q, struct spsc_record_view *v)
+{
+  spsc_record_view_start(v, spsc_queue_read(q, sizeof(struct spsc_record_frame)));
+}
+
+// Reader: like spsc_record_read() but returns 0 if the queue is empty.
+static inline int spsc_record_try_read(struct spsc_queue *q, struct spsc_record_view *v)
+{
+  const void *src = spsc_queue_try_read(q, sizeof(struct spsc_record_frame));
+
+  if (!src)
+    return 0;
+
+  spsc_record_view_start(v, src);
+
+  return 1;
+}
+
+// Reader: releases the record of the view.
+static inline void spsc_record_read_commit(struct spsc_queue *q, const struct spsc_record_view *v)
+{
+  spsc_queue_read_commit(q, spsc_record_stride(v->size));
+}
+
+// Returns a pointer to the next size bytes of the record, or NULL if the
+// record is shorter.
+static inline const void *spsc_record_next(struct spsc_record_view *v, size_t size)
+{
+  const char *src = v->data + v->pos;
+
+  if (unlikely(v->failed || size > v->size - v->pos))
+  {
+    v->failed = 1;
+    return NULL;
+  }
+
+  v->pos += size;
+
+  return src;
+}
+
+static inline int spsc_record_get(struct spsc_record_view *v, void *dst, size_t size)
+{
+  const void *src = spsc_record_next(v, size);
+
+  if (unlikely(!src))
+    return -1;
+
+  memcpy(dst, src, size);
+
+  return 0;
+}
+
+static inline int spsc_record_get_u8(struct spsc_record_view *v, uint8_t *value)
+{
+  return spsc_record_get(v, value, sizeof(*value));
+}
+
+static inline int spsc_record_get_u16(struct spsc_record_view *v, uint16_t *value)
+{
+  return spsc_record_get(v, value, sizeof(*value));
+}
+
+static inline int spsc_record_get_u32(struct spsc_record_view *v, uint32_t *value)
+{
+  return spsc_record_get(v, value, sizeof(*value));
+}
+
+static inline int spsc_record_get_u64(struct spsc_record_view *v, uint64_t *value)
+{
+  return spsc_record_get(v, value, sizeof(*value));
+}
+
+static inline int spsc_record_get_double(struct spsc_record_view *v, double *value)
+{
+  return spsc_record_get(v, value, sizeof(*value));
+}
+
+// Stores a pointer to the next blob in the ring in *src and its length in
+// *size.
+static inline int spsc_record_get_blob(struct spsc_record_view *v, const void **src, size_t *size)
+{
+  uint32_t length;
+
+  if (unlikely(spsc_record_get_u32(v, &length)))
+    return -1;
+
+  *src = spsc_record_next(v, length);
+
+  if (unlikely(!*src))
+    return -1;
+
+  *size = length;
+
+  return 0;
+}
+
+// Bytes of the record not parsed yet.
+static inline size_t spsc_record_remaining(const struct spsc_record_view *v)
+{
+  return v->size - v->pos;
+}
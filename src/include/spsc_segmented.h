@@ -0,0 +1,393 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Queue which grows by chaining fixed size segments.
+//
+// All segments come from one shared memory object, which is sparse, so
+// only segments in use take memory. When a write does not fit into the
+// current segment, the writer takes a free segment, links it to the
+// current one and continues there. The reader drains the old segment,
+// follows the link and hands the old segment back through a free list.
+//
+// Within a segment, writes cost the same as spsc_queue_write(): a
+// segment is a plain ring with an spsc_header. The last
+// SPSC_SEGMENTED_LINK_SIZE bytes of every segment are kept free for the
+// link commit, which moves write_offset on and so ends a futex wait of
+// the reader. The data is not framed, so the reader has to read records
+// as they were written; a record never spans two segments.
+//
+// The number of segments in use can be capped. Once the cap is reached,
+// the writer waits for space in its current segment, like a plain queue.
+// With SPSC_SEGMENTED_RELEASE, drained segments are punched out of the
+// object, so memory also shrinks back after a burst.
+
+#define SPSC_SEGMENTED_LINK_SIZE 8
+
+// Called by the writer between publishing a link and committing it. Stress
+// tests define it to yield there, which must not break the reader.
+#ifndef SPSC_SEGMENTED_LINK_HOOK
+#define SPSC_SEGMENTED_LINK_HOOK() do { } while (0)
+#endif
+
+enum spsc_segmented_flags
+{
+  SPSC_SEGMENTED_RELEASE = 1,
+};
+
+struct spsc_segment_header
+{
+  struct spsc_header header;
+  // Index of the next segment plus one, or 0.
+  SQ_ATOMIC(uint32_t) next;
+  // Write offset at which the segment was closed.
+  uint32_t end;
+  char padding[64 - sizeof(struct spsc_header) - 8];
+};
+
+struct spsc_segmented_control
+{
+  uint64_t segment_size;
+  uint32_t max_segments;
+  uint32_t cap;
+  uint32_t flags;
+  // Segments linked and not yet handed back.
+  SQ_ATOMIC(uint32_t) in_use;
+  // Free list, pushed by the reader and popped by the writer.
+  SQ_ATOMIC(uint32_t) free_head;
+  SQ_ATOMIC(uint32_t) free_tail;
+  // Segments from this index on have never been used.
+  SQ_ATOMIC(uint32_t) fresh;
+  // The segments the writer and the reader are in.
+  SQ_ATOMIC(uint32_t) write_segment;
+  SQ_ATOMIC(uint32_t) read_segment;
+};
+
+struct spsc_segmented
+{
+  struct spsc_segmented_control *control;
+  size_t control_size;
+  struct spsc_segment_header *headers;
+  uint32_t *free_list;
+  struct circular_area *areas;
+
+  struct spsc_queue writer;
+  struct spsc_queue reader;
+};
+
+static inline void spsc_segmented_init(struct spsc_segmented *q)
+{
+  q->control = (struct spsc_segmented_control*)MAP_FAILED;
+  q->control_size = 0;
+  q->headers = NULL;
+  q->free_list = NULL;
+  q->areas = NULL;
+  spsc_queue_init(&q->writer);
+  spsc_queue_init(&q->reader);
+}
+
+static inline size_t spsc_segmented_control_size(uint32_t max_segments)
+{
+  return shared_alloc_round_up(64 + max_segments * (sizeof(struct spsc_segment_header) + sizeof(uint32_t)));
+}
+
+static inline off_t spsc_segmented_shm_size(size_t segment_size, uint32_t max_segments)
+{
+  return (off_t)(spsc_segmented_control_size(max_segments) + (size_t)max_segments * segment_size);
+}
+
+static inline void spsc_segmented_free(struct spsc_segmented *q)
+{
+  if (q->areas)
+  {
+    for (uint32_t i = 0; i < q->control->max_segments; i++)
+      circular_area_free(&q->areas[i]);
+    free(q->areas);
+  }
+
+  q->control = (struct spsc_segmented_control*)shared_alloc_free(q->control, q->control_size);
+  spsc_segmented_init(q);
+}
+
+static inline void spsc_segmented_attach(struct spsc_queue *side, struct spsc_segmented *q, uint32_t segment)
+{
+  side->header = &q->headers[segment].header;
+  side->area = q->areas[segment];
+}
+
+static inline int spsc_segmented_map(struct spsc_segmented *q, int fd, uint32_t max_segments)
+{
+  size_t control_size = spsc_segmented_control_size(max_segments);
+
+  q->control = (struct spsc_segmented_control*)shared_alloc_mmap(control_size, fd, 0);
+
+  if (unlikely(q->control == MAP_FAILED))
+    return -1;
+
+  q->control_size = control_size;
+  q->headers = (struct spsc_segment_header*)((char*)q->control + 64);
+  q->free_list = (uint32_t*)(q->headers + max_segments);
+  q->areas = (struct circular_area*)calloc(max_segments, sizeof(struct circular_area));
+
+  if (unlikely(!q->areas))
+  {
+    spsc_segmented_free(q);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < max_segments; i++)
+    circular_area_init(&q->areas[i]);
+
+  for (uint32_t i = 0; i < max_segments; i++)
+  {
+    size_t offset = control_size + i * q->control->segment_size;
+
+    if (unlikely(circular_area_mmap(&q->areas[i], q->control->segment_size, fd, offset)))
+    {
+      spsc_segmented_free(q);
+      return -1;
+    }
+  }
+
+  spsc_segmented_attach(&q->writer, q, sq_read_once(q->control->write_segment));
+  spsc_segmented_attach(&q->reader, q, sq_read_once(q->control->read_segment));
+
+  return 0;
+}
+
+// Maps a queue from a file set up by spsc_segmented_create().
+static inline int spsc_segmented_fdopen(struct spsc_segmented *q, int fd)
+{
+  struct spsc_segmented_control *control;
+  uint32_t max_segments;
+
+  control = (struct spsc_segmented_control*)shared_alloc_mmap(sizeof(*control), fd, 0);
+
+  if (unlikely(control == MAP_FAILED))
+    return -1;
+
+  max_segments = control->max_segments;
+  shared_alloc_free(control, sizeof(*control));
+
+  if (unlikely(!max_segments))
+    return -1;
+
+  return spsc_segmented_map(q, fd, max_segments);
+}
+
+// Lays out a queue of up to max_segments segments of segment_size bytes
+// in the empty file fd. At most cap segments are in use at a time, or
+// max_segments if cap is 0. The segment size has to be a power of two and
+// a multiple of the page size.
+static inline int spsc_segmented_create(struct spsc_segmented *q, int fd, size_t segment_size,
+                                        uint32_t max_segments, uint32_t cap, uint32_t flags)
+{
+  struct spsc_segmented_control *control;
+
+  if (unlikely(!max_segments || segment_size <= SPSC_SEGMENTED_LINK_SIZE))
+    return -1;
+
+  if (unlikely(ftruncate(fd, spsc_segmented_shm_size(segment_size, max_segments))))
+    return -1;
+
+  control = (struct spsc_segmented_control*)shared_alloc_mmap(sizeof(*control), fd, 0);
+
+  if (unlikely(control == MAP_FAILED))
+    return -1;
+
+  control->segment_size = segment_size;
+  control->max_segments = max_segments;
+  control->cap = cap && cap < max_segments ? cap : max_segments;
+  control->flags = flags;
+  sq_store_once(control->in_use, (uint32_t)1);
+  sq_store_once(control->fresh, (uint32_t)1);
+
+  shared_alloc_free(control, sizeof(*control));
+
+  return spsc_segmented_map(q, fd, max_segments);
+}
+
+// Allocates a queue which has to be shared through fork() or between
+// threads.
+static inline int spsc_segmented_alloc_anonymous(struct spsc_segmented *q, size_t segment_size,
+                                                 uint32_t max_segments, uint32_t cap, uint32_t flags)
+{
+  int fd = memfd_create("spsc_segmented", MFD_CLOEXEC);
+
+  if (unlikely(fd < 0))
+    return -1;
+
+  int status = spsc_segmented_create(q, fd, segment_size, max_segments, cap, flags);
+
+  close(fd);
+
+  return status;
+}
+
+// Writer: takes a free segment. Returns its index, or -1 if the cap is
+// reached.
+static inline int64_t spsc_segmented_take(struct spsc_segmented *q)
+{
+  struct spsc_segmented_control *control = q->control;
+  uint32_t tail = sq_read_once(control->free_tail);
+  uint32_t segment;
+
+  if (sq_read_once(control->in_use) >= control->cap)
+    return -1;
+
+  if (tail != sq_read_once(control->free_head))
+  {
+    sq_thread_fence_acquire();
+    segment = q->free_list[tail % control->max_segments];
+    sq_store_once(control->free_tail, tail + 1);
+  }
+  else
+  {
+    segment = sq_read_once(control->fresh);
+
+    if (segment >= control->max_segments)
+      return -1;
+
+    sq_store_once(control->fresh, segment + 1);
+  }
+
+  sq_fetch_add_once(control->in_use, (uint32_t)1);
+
+  return segment;
+}
+
+// Writer: closes the current segment and continues in a new one. Returns
+// 0 if no segment is available.
+static inline int spsc_segmented_link(struct spsc_segmented *q)
+{
+  uint32_t current = sq_read_once(q->control->write_segment);
+  struct spsc_segment_header *header = &q->headers[current];
+  int64_t next = spsc_segmented_take(q);
+
+  if (next < 0)
+    return 0;
+
+  sq_store_once(q->control->write_segment, (uint32_t)next);
+
+  header->end = sq_read_once(header->header.write_offset);
+  sq_thread_fence_release();
+  sq_store_once(header->next, (uint32_t)next + 1);
+
+  SPSC_SEGMENTED_LINK_HOOK();
+
+  // The space for this commit is always kept free. The reader only
+  // recycles the segment once it sees this commit, since it would land on
+  // a reused header otherwise.
+  spsc_queue_write_commit(&q->writer, SPSC_SEGMENTED_LINK_SIZE);
+  spsc_segmented_attach(&q->writer, q, (uint32_t)next);
+
+  return 1;
+}
+
+// Writer: returns space for size bytes, which have to fit into a segment.
+// Links a new segment if the current one is full, or waits for the reader
+// if the cap is reached.
+static inline void *spsc_segmented_write(struct spsc_segmented *q, size_t size)
+{
+  size_t needed = size + SPSC_SEGMENTED_LINK_SIZE;
+  void *dst = spsc_queue_try_write(&q->writer, needed);
+
+  assert(needed <= q->control->segment_size);
+
+  if (likely(dst != NULL))
+    return dst;
+
+  // A new segment is empty, so this only waits if none was available.
+  spsc_segmented_link(q);
+
+  return spsc_queue_write(&q->writer, needed);
+}
+
+static inline void spsc_segmented_write_commit(struct spsc_segmented *q, size_t size)
+{
+  spsc_queue_write_commit(&q->writer, size);
+}
+
+static inline void spsc_segmented_write_from(struct spsc_segmented *q, const void *src, size_t size)
+{
+  memcpy(spsc_segmented_write(q, size), src, size);
+  spsc_segmented_write_commit(q, size);
+}
+
+// Reader: hands the drained segment back and moves to the next one.
+static inline void spsc_segmented_follow(struct spsc_segmented *q, uint32_t next)
+{
+  struct spsc_segmented_control *control = q->control;
+  uint32_t current = sq_read_once(control->read_segment);
+  struct spsc_segment_header *header = &q->headers[current];
+  uint32_t head = sq_read_once(control->free_head);
+
+  sq_store_once(header->header.write_offset, (uint32_t)0);
+  sq_store_once(header->header.write_size, (size_t)0);
+  sq_store_once(header->header.read_offset, (uint32_t)0);
+  sq_store_once(header->header.read_size, (size_t)0);
+  sq_store_once(header->next, (uint32_t)0);
+  header->end = 0;
+
+  if (control->flags & SPSC_SEGMENTED_RELEASE)
+    madvise(q->areas[current].base, control->segment_size, MADV_REMOVE);
+
+  sq_store_once(control->read_segment, next);
+  spsc_segmented_attach(&q->reader, q, next);
+
+  q->free_list[head % control->max_segments] = current;
+  sq_thread_fence_release();
+  sq_store_once(control->free_head, head + 1);
+  sq_fetch_add_once(control->in_use, (uint32_t)-1);
+}
+
+// Reader: waits for size bytes and returns a pointer to them.
+static inline const void *spsc_segmented_read(struct spsc_segmented *q, size_t size)
+{
+  while (1)
+  {
+    struct spsc_segment_header *header = (struct spsc_segment_header*)q->reader.header;
+    uint32_t read_offset = sq_read_once(header->header.read_offset);
+    uint32_t write_offset = sq_read_once(header->header.write_offset);
+
+    // The link is visible once the link commit is.
+    sq_thread_fence_acquire();
+
+    uint32_t next = sq_read_once(header->next);
+
+    // And end once next is.
+    sq_thread_fence_acquire();
+
+    // next is stored before the link commit, so follow only once that
+    // commit is done, or the writer still touches this header. Until then
+    // the reader waits for the commit like for any other.
+    if (next && read_offset == header->end && write_offset == header->end + SPSC_SEGMENTED_LINK_SIZE)
+    {
+      spsc_segmented_follow(q, next - 1);
+      continue;
+    }
+
+    if (likely(write_offset - read_offset >= size))
+      return circular_area_get_pointer(&q->reader.area, read_offset);
+
+    sq_store_once(header->header.read_size, size);
+    futex_wait(&header->header.write_offset, write_offset);
+  }
+}
+
+static inline void spsc_segmented_read_commit(struct spsc_segmented *q, size_t size)
+{
+  spsc_queue_read_commit(&q->reader, size);
+}
+
+static inline void spsc_segmented_read_to(struct spsc_segmented *q, void *dst, size_t size)
+{
+  memcpy(dst, spsc_segmented_read(q, size), size);
+  spsc_segmented_read_commit(q, size);
+}
+
+// Number of segments currently in use.
+static inline uint32_t spsc_segmented_in_use(const struct spsc_segmented *q)
+{
+  return sq_read_once(q->control->in_use);
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+// Selector for a consumer which serves many queues.
+//
+// The selector keeps a shared bitmap with one ready bit per queue. A
+// producer sets the bit of its queue when it commits while the bit is
+// clear, which is the case when the consumer has found that queue empty.
+// The consumer sleeps on a single futex until any bit is set and then
+// finds the ready queues with ctz instead of polling every header.
+//
+// Consumer loop:
+//
+//   while (1)
+//   {
+//     int i = spsc_select_next(&sel);
+//
+//     if (!spsc_queue_try_read_to(queues[i], buf, size))
+//       spsc_select_empty(&sel, i);
+//     else
+//       ...
+//   }
+
+#define SPSC_SELECT_MAX   1024
+#define SPSC_SELECT_WORDS (SPSC_SELECT_MAX / 64)
+
+struct spsc_select_shared
+{
+  // Futex word, incremented whenever a bit is set.
+  SQ_ATOMIC(uint32_t) seq;
+  // Non-zero while the consumer is waiting on seq.
+  SQ_ATOMIC(uint32_t) waiting;
+  SQ_ATOMIC(uint64_t) ready[SPSC_SELECT_WORDS];
+};
+
+struct spsc_select
+{
+  struct spsc_select_shared *shared;
+
+  // Consumer state.
+  unsigned int count;
+  unsigned int cursor;
+  unsigned int served;
+  struct spsc_queue *queues[SPSC_SELECT_MAX];
+  unsigned int weights[SPSC_SELECT_MAX];
+};
+
+static inline void spsc_select_init(struct spsc_select *sel)
+{
+  sel->shared = (struct spsc_select_shared*)MAP_FAILED;
+  sel->count = 0;
+  sel->cursor = 0;
+  sel->served = 0;
+}
+
+static inline int spsc_select_alloc_anonymous(struct spsc_select *sel)
+{
+  sel->shared = (struct spsc_select_shared*)shared_alloc_anonymous(sizeof(struct spsc_select_shared));
+
+  return sel->shared == MAP_FAILED ? -1 : 0;
+}
+
+static inline int spsc_select_fdopen(struct spsc_select *sel, int fd)
+{
+  sel->shared = (struct spsc_select_shared*)shared_alloc_mmap(sizeof(struct spsc_select_shared), fd, 0);
+
+  return sel->shared == MAP_FAILED ? -1 : 0;
+}
+
+static inline off_t spsc_select_shm_size()
+{
+  return (off_t)shared_alloc_round_up(sizeof(struct spsc_select_shared));
+}
+
+static inline void spsc_select_free(struct spsc_select *sel)
+{
+  sel->shared = (struct spsc_select_shared*)shared_alloc_free(sel->shared, sizeof(struct spsc_select_shared));
+}
+
+// Registers the consumer side of queue number index. The queue is served
+// up to weight times in a row before the next ready queue is selected.
+static inline void spsc_select_add(struct spsc_select *sel, unsigned int index, struct spsc_queue *q,
+                                   unsigned int weight)
+{
+  assert(index < SPSC_SELECT_MAX);
+
+  sel->queues[index] = q;
+  sel->weights[index] = weight ? weight : 1;
+
+  if (index >= sel->count)
+    sel->count = index + 1;
+
+  // The queue may already contain data.
+  sq_fetch_or_once(sel->shared->ready[index / 64], (uint64_t)1 << (index % 64));
+}
+
+// Called by the producer of queue number index after committing.
+static inline void spsc_select_notify(struct spsc_select_shared *shared, unsigned int index)
+{
+  SQ_ATOMIC(uint64_t) *word = &shared->ready[index / 64];
+  uint64_t bit = (uint64_t)1 << (index % 64);
+
+  // The consumer has not found the queue empty since we last set it.
+  if (likely(sq_read_once(*word) & bit))
+    return;
+
+  sq_thread_fence_release();
+  sq_fetch_or_once(*word, bit);
+  sq_fetch_add_once(shared->seq, (uint32_t)1);
+  sq_thread_fence_acquire();
+
+  if (unlikely(sq_read_once(shared->waiting)))
+    futex_wake(&shared->seq, 1);
+}
+
+static inline void spsc_select_write_commit(struct spsc_select_shared *shared, unsigned int index,
+                                            struct spsc_queue *q, size_t size)
+{
+  spsc_queue_write_commit(q, size);
+  spsc_select_notify(shared, index);
+}
+
+static inline void spsc_select_write_from(struct spsc_select_shared *shared, unsigned int index,
+                                          struct spsc_queue *q, const void *src, size_t size)
+{
+  void *dst = spsc_queue_write(q, size);
+
+  memcpy(dst, src, size);
+
+  spsc_select_write_commit(shared, index, q, size);
+}
+
+// Returns the first ready queue at or after the cursor, wrapping around,
+// or -1 if no queue is ready.
+static inline int spsc_select_scan(const struct spsc_select *sel)
+{
+  unsigned int words = (sel->count + 63) / 64;
+  unsigned int first = sel->cursor / 64;
+
+  for (unsigned int i = 0; i <= words; i++)
+  {
+    unsigned int w = (first + i) % words;
+    uint64_t bits = sq_read_once(sel->shared->ready[w]);
+
+    // Only bits at or after the cursor in the first round.
+    if (i == 0)
+      bits &= ~(uint64_t)0 << (sel->cursor % 64);
+
+    if (bits)
+      return (int)(w * 64 + __builtin_ctzll(bits));
+  }
+
+  return -1;
+}
+
+// Waits until a queue is ready and returns its index. Queues are selected
+// round-robin, each one up to its weight times in a row.
+static inline int spsc_select_next(struct spsc_select *sel)
+{
+  struct spsc_select_shared *shared = sel->shared;
+
+  assert(sel->count);
+
+  if (sel->served >= sel->weights[sel->cursor])
+  {
+    sel->cursor = (sel->cursor + 1) % sel->count;
+    sel->served = 0;
+  }
+
+  while (1)
+  {
+    uint32_t seq = sq_read_once(shared->seq);
+    int index = spsc_select_scan(sel);
+
+    if (likely(index >= 0))
+    {
+      sq_thread_fence_acquire();
+
+      if ((unsigned int)index != sel->cursor)
+      {
+        sel->cursor = (unsigned int)index;
+        sel->served = 0;
+      }
+
+      sel->served++;
+      return index;
+    }
+
+    sq_store_once(shared->waiting, (uint32_t)1);
+    sq_thread_fence_acquire();
+
+    if (sq_read_once(shared->seq) == seq && spsc_select_scan(sel) < 0)
+      futex_wait(&shared->seq, seq);
+
+    sq_store_once(shared->waiting, (uint32_t)0);
+  }
+}
+
+// Called by the consumer when queue number index was found empty. Clears
+// the ready bit and moves on to the next queue.
+static inline void spsc_select_empty(struct spsc_select *sel, unsigned int index)
+{
+  SQ_ATOMIC(uint64_t) *word = &sel->shared->ready[index / 64];
+  uint64_t bit = (uint64_t)1 << (index % 64);
+
+  sq_fetch_and_once(*word, ~bit);
+  sq_thread_fence_acquire();
+
+  // The producer skips the notification while the bit is set, so it may
+  // have committed right before we cleared it.
+  if (spsc_queue_read_size(sel->queues[index]))
+    sq_fetch_or_once(*word, bit);
+
+  sel->served = sel->weights[index];
+}
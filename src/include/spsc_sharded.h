@@ -0,0 +1,469 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <limits.h>
+
+// Sharded queue for one producer and a consumer per lane.
+//
+// The producer hashes the key of every record onto one of
+// SPSC_SHARDED_BUCKETS buckets, and every bucket onto one of up to
+// SPSC_SHARDED_MAX_LANES lanes. Each lane is a plain spsc_queue drained by
+// its own consumer thread or process, so records with the same key stay in
+// order. Records are prefixed with a struct spsc_sharded_frame and padded
+// to a multiple of 8 bytes.
+//
+// spsc_sharded_rebalance() moves a bucket from the lane with the largest
+// backlog to the one with the smallest. If the bucket still has records in
+// the old lane, a fence frame in the new lane makes its consumer wait
+// until the old lane has been read past them, which keeps the key order
+// across the move. The consumer sleeps on the read offset of the old lane,
+// which the consumer of that lane wakes after committing while anyone
+// waits on one of its fences.
+//
+// The bucket map lives with the producer. Consumers only need the lanes,
+// so a sharded queue set up before fork() can be drained by child
+// processes.
+
+#define SPSC_SHARDED_ALIGN      8
+#define SPSC_SHARDED_MAX_LANES  64
+#define SPSC_SHARDED_BUCKETS    256
+// Records grouped per lane by spsc_sharded_write_batch() at a time.
+#define SPSC_SHARDED_BATCH      64
+
+enum spsc_sharded_frame_type
+{
+  SPSC_SHARDED_FRAME_DATA,
+  SPSC_SHARDED_FRAME_FENCE,
+};
+
+struct spsc_sharded_frame
+{
+  uint64_t key;
+  uint32_t size;
+  uint32_t type;
+};
+
+// Payload of a fence frame: wait until lane has been read up to offset.
+struct spsc_sharded_fence
+{
+  uint32_t lane;
+  uint32_t offset;
+};
+
+// Shared between the producer and all consumers.
+struct spsc_sharded_shared
+{
+  // Number of consumers sleeping on the read offset of each lane.
+  SQ_ATOMIC(uint32_t) fence_waiters[SPSC_SHARDED_MAX_LANES];
+};
+
+struct spsc_sharded_record
+{
+  uint64_t key;
+  const void *data;
+  size_t size;
+};
+
+struct spsc_sharded
+{
+  unsigned int lanes;
+  struct spsc_queue lane[SPSC_SHARDED_MAX_LANES];
+  struct spsc_sharded_shared *shared;
+
+  // Producer state.
+  uint8_t map[SPSC_SHARDED_BUCKETS];
+  // Write offset in its lane after the last record of each bucket.
+  uint32_t bucket_end[SPSC_SHARDED_BUCKETS];
+  // Bytes written per bucket since the last rebalance.
+  uint64_t bucket_load[SPSC_SHARDED_BUCKETS];
+};
+
+static inline void spsc_sharded_init(struct spsc_sharded *s)
+{
+  s->lanes = 0;
+  s->shared = (struct spsc_sharded_shared*)MAP_FAILED;
+
+  for (unsigned int i = 0; i < SPSC_SHARDED_MAX_LANES; i++)
+    spsc_queue_init(&s->lane[i]);
+
+  for (unsigned int b = 0; b < SPSC_SHARDED_BUCKETS; b++)
+  {
+    s->map[b] = 0;
+    s->bucket_end[b] = 0;
+    s->bucket_load[b] = 0;
+  }
+}
+
+static inline void spsc_sharded_free(struct spsc_sharded *s)
+{
+  for (unsigned int i = 0; i < s->lanes; i++)
+    spsc_queue_free(&s->lane[i]);
+
+  s->lanes = 0;
+  s->shared = (struct spsc_sharded_shared*)shared_alloc_free(s->shared, sizeof(*s->shared));
+}
+
+// Allocates lanes rings of size bytes each. The queue has to be shared
+// through fork() or between threads.
+static inline int spsc_sharded_alloc_anonymous(struct spsc_sharded *s, unsigned int lanes, size_t size)
+{
+  if (unlikely(!lanes || lanes > SPSC_SHARDED_MAX_LANES))
+    return -1;
+
+  s->shared = (struct spsc_sharded_shared*)shared_alloc_anonymous(sizeof(*s->shared));
+
+  if (unlikely(s->shared == MAP_FAILED))
+    return -1;
+
+  for (s->lanes = 0; s->lanes < lanes; s->lanes++)
+  {
+    if (unlikely(spsc_queue_alloc_anonymous(&s->lane[s->lanes], size)))
+    {
+      spsc_sharded_free(s);
+      return -1;
+    }
+  }
+
+  for (unsigned int b = 0; b < SPSC_SHARDED_BUCKETS; b++)
+    s->map[b] = (uint8_t)(b % lanes);
+
+  return 0;
+}
+
+static inline struct spsc_queue *spsc_sharded_lane(struct spsc_sharded *s, unsigned int lane)
+{
+  return &s->lane[lane];
+}
+
+static inline unsigned int spsc_sharded_bucket(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+
+  return (unsigned int)(key & (SPSC_SHARDED_BUCKETS - 1));
+}
+
+// Returns the lane records with the given key currently go to.
+static inline unsigned int spsc_sharded_lane_of(const struct spsc_sharded *s, uint64_t key)
+{
+  return s->map[spsc_sharded_bucket(key)];
+}
+
+static inline size_t spsc_sharded_stride(size_t size)
+{
+  size += sizeof(struct spsc_sharded_frame);
+  return (size + (SPSC_SHARDED_ALIGN - 1)) & ~(size_t)(SPSC_SHARDED_ALIGN - 1);
+}
+
+static inline size_t spsc_sharded_put(char *dst, uint64_t key, uint32_t type, const void *src, size_t size)
+{
+  struct spsc_sharded_frame frame = { key, (uint32_t)size, type };
+
+  memcpy(dst, &frame, sizeof(frame));
+  if (size)
+    memcpy(dst + sizeof(frame), src, size);
+
+  return spsc_sharded_stride(size);
+}
+
+static inline void spsc_sharded_account(struct spsc_sharded *s, unsigned int bucket, size_t stride)
+{
+  struct spsc_queue *q = &s->lane[s->map[bucket]];
+
+  s->bucket_end[bucket] = sq_read_once(q->header->write_offset);
+  s->bucket_load[bucket] += stride;
+}
+
+// Producer: waits for space in the lane of key and writes the record.
+static inline void spsc_sharded_write_from(struct spsc_sharded *s, uint64_t key, const void *src, size_t size)
+{
+  unsigned int bucket = spsc_sharded_bucket(key);
+  struct spsc_queue *q = &s->lane[s->map[bucket]];
+  size_t stride = spsc_sharded_stride(size);
+
+  spsc_sharded_put((char*)spsc_queue_write(q, stride), key, SPSC_SHARDED_FRAME_DATA, src, size);
+  spsc_queue_write_commit(q, stride);
+  spsc_sharded_account(s, bucket, stride);
+}
+
+// Producer: writes the record to every lane, for example to mark the end
+// of the stream.
+static inline void spsc_sharded_broadcast(struct spsc_sharded *s, uint64_t key, const void *src, size_t size)
+{
+  size_t stride = spsc_sharded_stride(size);
+
+  for (unsigned int lane = 0; lane < s->lanes; lane++)
+  {
+    struct spsc_queue *q = &s->lane[lane];
+
+    spsc_sharded_put((char*)spsc_queue_write(q, stride), key, SPSC_SHARDED_FRAME_DATA, src, size);
+    spsc_queue_write_commit(q, stride);
+  }
+}
+
+// Producer: writes count records. The records of each lane are written
+// with one reservation and one commit, so a consumer is woken at most once
+// per lane and batch.
+static inline void spsc_sharded_write_batch(struct spsc_sharded *s, const struct spsc_sharded_record *records,
+                                            size_t count)
+{
+  while (count)
+  {
+    size_t n = count < SPSC_SHARDED_BATCH ? count : SPSC_SHARDED_BATCH;
+    size_t bytes[SPSC_SHARDED_MAX_LANES] = { 0 };
+    uint8_t buckets[SPSC_SHARDED_BATCH];
+
+    for (size_t i = 0; i < n; i++)
+    {
+      buckets[i] = (uint8_t)spsc_sharded_bucket(records[i].key);
+      bytes[s->map[buckets[i]]] += spsc_sharded_stride(records[i].size);
+    }
+
+    for (unsigned int lane = 0; lane < s->lanes; lane++)
+    {
+      struct spsc_queue *q = &s->lane[lane];
+
+      if (!bytes[lane])
+        continue;
+
+      if (unlikely(bytes[lane] > spsc_queue_capacity(q)))
+      {
+        for (size_t i = 0; i < n; i++)
+        {
+          if (s->map[buckets[i]] == lane)
+            spsc_sharded_write_from(s, records[i].key, records[i].data, records[i].size);
+        }
+        continue;
+      }
+
+      char *dst = (char*)spsc_queue_write(q, bytes[lane]);
+
+      for (size_t i = 0; i < n; i++)
+      {
+        if (s->map[buckets[i]] == lane)
+          dst += spsc_sharded_put(dst, records[i].key, SPSC_SHARDED_FRAME_DATA, records[i].data, records[i].size);
+      }
+
+      spsc_queue_write_commit(q, bytes[lane]);
+
+      for (size_t i = 0; i < n; i++)
+      {
+        if (s->map[buckets[i]] == lane)
+          spsc_sharded_account(s, buckets[i], spsc_sharded_stride(records[i].size));
+      }
+    }
+
+    records += n;
+    count -= n;
+  }
+}
+
+// Producer: moves the bucket which is closest to carrying half the load
+// of the lane with the largest backlog to the lane with the smallest, if
+// the first has more than twice the backlog of the second plus slack.
+// Call it at points where the producer may block on the fence frame.
+// Returns 1 if a bucket was moved.
+static inline int spsc_sharded_rebalance(struct spsc_sharded *s, size_t slack)
+{
+  unsigned int hot = 0;
+  unsigned int cold = 0;
+  size_t backlog[SPSC_SHARDED_MAX_LANES];
+  uint64_t lane_load[SPSC_SHARDED_MAX_LANES] = { 0 };
+  int moved = 0;
+
+  if (unlikely(!s->lanes))
+    return 0;
+
+  for (unsigned int lane = 0; lane < s->lanes; lane++)
+  {
+    backlog[lane] = spsc_queue_read_size(&s->lane[lane]);
+
+    if (backlog[lane] > backlog[hot])
+      hot = lane;
+    if (backlog[lane] < backlog[cold])
+      cold = lane;
+  }
+
+  for (unsigned int b = 0; b < SPSC_SHARDED_BUCKETS; b++)
+    lane_load[s->map[b]] += s->bucket_load[b];
+
+  do
+  {
+    if (backlog[hot] <= 2 * backlog[cold] + slack)
+      break;
+
+    unsigned int best = SPSC_SHARDED_BUCKETS;
+    uint64_t target = lane_load[hot] / 2;
+    uint64_t best_distance = 0;
+
+    for (unsigned int b = 0; b < SPSC_SHARDED_BUCKETS; b++)
+    {
+      if (s->map[b] != hot || !s->bucket_load[b])
+        continue;
+
+      uint64_t distance = s->bucket_load[b] > target ? s->bucket_load[b] - target : target - s->bucket_load[b];
+
+      if (best == SPSC_SHARDED_BUCKETS || distance < best_distance)
+      {
+        best = b;
+        best_distance = distance;
+      }
+    }
+
+    // Moving the only busy bucket would just move the hot spot.
+    if (best == SPSC_SHARDED_BUCKETS || s->bucket_load[best] == lane_load[hot])
+      break;
+
+    uint32_t read_offset = sq_read_once(s->lane[hot].header->read_offset);
+
+    if ((int32_t)(s->bucket_end[best] - read_offset) > 0)
+    {
+      struct spsc_sharded_fence fence = { hot, s->bucket_end[best] };
+      struct spsc_queue *q = &s->lane[cold];
+      size_t stride = spsc_sharded_stride(sizeof(fence));
+
+      spsc_sharded_put((char*)spsc_queue_write(q, stride), 0, SPSC_SHARDED_FRAME_FENCE, &fence, sizeof(fence));
+      spsc_queue_write_commit(q, stride);
+    }
+
+    s->map[best] = (uint8_t)cold;
+    s->bucket_end[best] = sq_read_once(s->lane[cold].header->write_offset);
+    moved = 1;
+  }
+  while (0);
+
+  for (unsigned int b = 0; b < SPSC_SHARDED_BUCKETS; b++)
+    s->bucket_load[b] = 0;
+
+  return moved;
+}
+
+// Consumer: waits until the lane of a fence has been read far enough.
+static inline void spsc_sharded_wait_fence(struct spsc_sharded *s, const void *src)
+{
+  struct spsc_sharded_fence fence;
+  struct spsc_header *header;
+  SQ_ATOMIC(uint32_t) *waiters;
+
+  memcpy(&fence, (const char*)src + sizeof(struct spsc_sharded_frame), sizeof(fence));
+  header = s->lane[fence.lane].header;
+  waiters = &s->shared->fence_waiters[fence.lane];
+
+  while (1)
+  {
+    uint32_t read_offset = sq_read_once(header->read_offset);
+
+    if ((int32_t)(read_offset - fence.offset) >= 0)
+      break;
+
+    // Either the consumer of the lane sees us waiting after its commit,
+    // or we see the new offset here.
+    sq_fetch_add_once(*waiters, (uint32_t)1);
+    sq_thread_fence_acquire();
+
+    if (sq_read_once(header->read_offset) == read_offset)
+      futex_wait(&header->read_offset, read_offset);
+
+    sq_fetch_add_once(*waiters, (uint32_t)-1);
+  }
+
+  sq_thread_fence_acquire();
+}
+
+// Consumer: like spsc_queue_read_commit(), but also wakes consumers
+// waiting on a fence for the lane. They sleep on the same futex as the
+// producer, so waking just one might pick the wrong one, and all are
+// woken instead.
+static inline void spsc_sharded_commit(struct spsc_sharded *s, unsigned int lane, size_t bytes)
+{
+  struct spsc_queue *q = &s->lane[lane];
+
+  sq_thread_fence_release();
+  uint32_t read_offset = sq_fetch_add_once(q->header->read_offset, (uint32_t)bytes);
+  sq_thread_fence_acquire();
+  uint32_t write_offset = sq_read_once(q->header->write_offset);
+  size_t write_size = sq_read_once(q->header->write_size);
+  uint32_t waiters = sq_read_once(s->shared->fence_waiters[lane]);
+
+  if (unlikely(waiters))
+    futex_wake(&q->header->read_offset, INT_MAX);
+  else if (unlikely(q->area.size < (write_offset - read_offset) + write_size))
+    spsc_queue_wake_writer(q);
+}
+
+// Consumer: waits for data in the lane and returns the first frame,
+// resolving fences on the way.
+static inline const char *spsc_sharded_next(struct spsc_sharded *s, unsigned int lane,
+                                            struct spsc_sharded_frame *frame)
+{
+  struct spsc_queue *q = &s->lane[lane];
+
+  while (1)
+  {
+    const char *src = (const char*)spsc_queue_read(q, sizeof(*frame));
+
+    // The producer commits whole frames.
+    memcpy(frame, src, sizeof(*frame));
+
+    if (likely(frame->type == SPSC_SHARDED_FRAME_DATA))
+      return src;
+
+    spsc_sharded_wait_fence(s, src);
+    spsc_sharded_commit(s, lane, spsc_sharded_stride(frame->size));
+  }
+}
+
+// Consumer: waits for the next record in the lane and copies at most max
+// bytes of it to dst. Returns the size of the record.
+static inline size_t spsc_sharded_read_to(struct spsc_sharded *s, unsigned int lane, uint64_t *key,
+                                          void *dst, size_t max)
+{
+  struct spsc_sharded_frame frame;
+  const char *src = spsc_sharded_next(s, lane, &frame);
+
+  memcpy(dst, src + sizeof(frame), frame.size < max ? frame.size : max);
+  *key = frame.key;
+
+  spsc_sharded_commit(s, lane, spsc_sharded_stride(frame.size));
+
+  return frame.size;
+}
+
+// Consumer: waits for data in the lane and returns up to max records in
+// place. The records stay valid until spsc_sharded_read_commit() is
+// called with the number of bytes stored in *bytes.
+static inline size_t spsc_sharded_read_batch(struct spsc_sharded *s, unsigned int lane,
+                                             struct spsc_sharded_record *records, size_t max, size_t *bytes)
+{
+  struct spsc_sharded_frame frame;
+  const char *src = spsc_sharded_next(s, lane, &frame);
+  size_t available = spsc_queue_read_size(&s->lane[lane]);
+  size_t offset = 0;
+  size_t n = 0;
+
+  while (n < max && offset < available)
+  {
+    memcpy(&frame, src + offset, sizeof(frame));
+
+    // A fence is resolved on the next call.
+    if (frame.type != SPSC_SHARDED_FRAME_DATA)
+      break;
+
+    records[n].key = frame.key;
+    records[n].data = src + offset + sizeof(frame);
+    records[n].size = frame.size;
+    offset += spsc_sharded_stride(frame.size);
+    n++;
+  }
+
+  *bytes = offset;
+
+  return n;
+}
+
+static inline void spsc_sharded_read_commit(struct spsc_sharded *s, unsigned int lane, size_t bytes)
+{
+  spsc_sharded_commit(s, lane, bytes);
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+// Time-in-queue tracing.
+//
+// When SPSC_TRACE is defined, spsc_trace_write_commit() prefixes every
+// commit with the current tick count, and spsc_trace_read() adds the time
+// the data spent in the queue to a struct spsc_trace_histogram. One commit
+// may carry a whole batch of records, which is then stamped once. Without
+// SPSC_TRACE the stamp is not written and both sides compile down to the
+// plain queue functions, so writer and reader have to be built with the
+// same setting.
+//
+// Ticks come from the TSC on x86, from the virtual counter on aarch64 and
+// from CLOCK_MONOTONIC elsewhere. The TSC is assumed to be invariant and
+// synchronised between cores. spsc_trace_calibrate() measures its rate,
+// which is only needed to report the results in nanoseconds.
+//
+// The histogram lives in shared memory and can be updated by any number
+// of consumers and read by a monitoring process at any time. Buckets are
+// log-linear with 4 buckets per power of two, so percentiles are accurate
+// to 25%.
+
+#ifdef SPSC_TRACE
+# define SPSC_TRACE_STAMP_SIZE 8
+#else
+# define SPSC_TRACE_STAMP_SIZE 0
+#endif
+
+#define SPSC_TRACE_SUB_BITS 2
+#define SPSC_TRACE_BUCKETS  (64 << SPSC_TRACE_SUB_BITS)
+
+struct spsc_trace_histogram
+{
+  double ns_per_tick;
+  SQ_ATOMIC(uint64_t) max;
+  SQ_ATOMIC(uint64_t) sum;
+  SQ_ATOMIC(uint64_t) buckets[SPSC_TRACE_BUCKETS];
+};
+
+static inline uint64_t spsc_trace_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return 1000 * 1000 * 1000 * (uint64_t)now.tv_sec + now.tv_nsec;
+#endif
+}
+
+static inline struct spsc_trace_histogram *spsc_trace_alloc_anonymous()
+{
+  return (struct spsc_trace_histogram*)shared_alloc_anonymous(sizeof(struct spsc_trace_histogram));
+}
+
+static inline struct spsc_trace_histogram *spsc_trace_fdopen(int fd)
+{
+  return (struct spsc_trace_histogram*)shared_alloc_mmap(sizeof(struct spsc_trace_histogram), fd, 0);
+}
+
+static inline off_t spsc_trace_shm_size()
+{
+  return (off_t)shared_alloc_round_up(sizeof(struct spsc_trace_histogram));
+}
+
+static inline void spsc_trace_free(struct spsc_trace_histogram *h)
+{
+  shared_alloc_free(h, sizeof(*h));
+}
+
+// Measures the tick rate against CLOCK_MONOTONIC for about ms
+// milliseconds.
+static inline void spsc_trace_calibrate(struct spsc_trace_histogram *h, unsigned int ms)
+{
+  struct timespec start, now;
+  uint64_t start_ticks = spsc_trace_ticks();
+  uint64_t ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = 1000 * 1000 * 1000 * (uint64_t)(now.tv_sec - start.tv_sec) + now.tv_nsec - start.tv_nsec;
+  }
+  while (ns < 1000 * 1000 * (uint64_t)ms);
+
+  h->ns_per_tick = (double)ns / (double)(spsc_trace_ticks() - start_ticks);
+}
+
+static inline unsigned int spsc_trace_bucket(uint64_t ticks)
+{
+  if (ticks < (1 << SPSC_TRACE_SUB_BITS))
+    return (unsigned int)ticks;
+
+  unsigned int msb = 63 - __builtin_clzll(ticks);
+  unsigned int sub = (unsigned int)(ticks >> (msb - SPSC_TRACE_SUB_BITS)) & ((1 << SPSC_TRACE_SUB_BITS) - 1);
+
+  return ((msb - SPSC_TRACE_SUB_BITS + 1) << SPSC_TRACE_SUB_BITS) + sub;
+}
+
+// Lower bound of a bucket in ticks.
+static inline uint64_t spsc_trace_bucket_ticks(unsigned int bucket)
+{
+  if (bucket < (1 << SPSC_TRACE_SUB_BITS))
+    return bucket;
+
+  unsigned int msb = (bucket >> SPSC_TRACE_SUB_BITS) + SPSC_TRACE_SUB_BITS - 1;
+  uint64_t sub = bucket & ((1 << SPSC_TRACE_SUB_BITS) - 1);
+
+  return (((uint64_t)1 << SPSC_TRACE_SUB_BITS) + sub) << (msb - SPSC_TRACE_SUB_BITS);
+}
+
+static inline void spsc_trace_histogram_add(struct spsc_trace_histogram *h, uint64_t ticks)
+{
+  sq_fetch_add_once(h->buckets[spsc_trace_bucket(ticks)], (uint64_t)1);
+  sq_fetch_add_once(h->sum, ticks);
+
+  uint64_t max = sq_read_once(h->max);
+
+  while (unlikely(ticks > max))
+  {
+    if (sq_compare_exchange(h->max, max, ticks))
+      break;
+    max = sq_read_once(h->max);
+  }
+}
+
+static inline uint64_t spsc_trace_count(const struct spsc_trace_histogram *h)
+{
+  uint64_t count = 0;
+
+  for (unsigned int i = 0; i < SPSC_TRACE_BUCKETS; i++)
+    count += sq_read_once(h->buckets[i]);
+
+  return count;
+}
+
+// Returns the lower bound of the bucket holding the given percentile, in
+// nanoseconds.
+static inline double spsc_trace_percentile(const struct spsc_trace_histogram *h, double percentile)
+{
+  uint64_t count = spsc_trace_count(h);
+  uint64_t rank = (uint64_t)(count * percentile / 100);
+  uint64_t seen = 0;
+
+  for (unsigned int i = 0; i < SPSC_TRACE_BUCKETS; i++)
+  {
+    seen += sq_read_once(h->buckets[i]);
+
+    if (seen > rank)
+      return spsc_trace_bucket_ticks(i) * h->ns_per_tick;
+  }
+
+  return sq_read_once(h->max) * h->ns_per_tick;
+}
+
+static inline double spsc_trace_mean(const struct spsc_trace_histogram *h)
+{
+  uint64_t count = spsc_trace_count(h);
+
+  return count ? sq_read_once(h->sum) * h->ns_per_tick / count : 0;
+}
+
+static inline void spsc_trace_reset(struct spsc_trace_histogram *h)
+{
+  for (unsigned int i = 0; i < SPSC_TRACE_BUCKETS; i++)
+    sq_store_once(h->buckets[i], (uint64_t)0);
+
+  sq_store_once(h->sum, (uint64_t)0);
+  sq_store_once(h->max, (uint64_t)0);
+}
+
+// Writer: waits for space for size bytes and returns a pointer to them.
+static inline void *spsc_trace_write(struct spsc_queue *q, size_t size)
+{
+  return (char*)spsc_queue_write(q, size + SPSC_TRACE_STAMP_SIZE) + SPSC_TRACE_STAMP_SIZE;
+}
+
+// Writer: stamps the data with the current tick count and commits it.
+static inline void spsc_trace_write_commit(struct spsc_queue *q, size_t size)
+{
+#ifdef SPSC_TRACE
+  uint64_t ticks = spsc_trace_ticks();
+
+  memcpy(circular_area_get_pointer(&q->area, sq_read_once(q->header->write_offset)), &ticks, sizeof(ticks));
+#endif
+  spsc_queue_write_commit(q, size + SPSC_TRACE_STAMP_SIZE);
+}
+
+static inline void spsc_trace_write_from(struct spsc_queue *q, const void *src, size_t size)
+{
+  memcpy(spsc_trace_write(q, size), src, size);
+  spsc_trace_write_commit(q, size);
+}
+
+// Reader: waits for size bytes of data, adds its time in the queue to the
+// histogram and returns a pointer to it.
+static inline const void *spsc_trace_read(struct spsc_queue *q, struct spsc_trace_histogram *h, size_t size)
+{
+  const char *src = (const char*)spsc_queue_read(q, size + SPSC_TRACE_STAMP_SIZE);
+
+#ifdef SPSC_TRACE
+  uint64_t now = spsc_trace_ticks();
+  uint64_t stamp;
+
+  memcpy(&stamp, src, sizeof(stamp));
+
+  // Ticks of different cores may be slightly apart.
+  spsc_trace_histogram_add(h, (int64_t)(now - stamp) > 0 ? now - stamp : 0);
+#else
+  (void)h;
+#endif
+
+  return src + SPSC_TRACE_STAMP_SIZE;
+}
+
+static inline void spsc_trace_read_commit(struct spsc_queue *q, size_t size)
+{
+  spsc_queue_read_commit(q, size + SPSC_TRACE_STAMP_SIZE);
+}
+
+static inline void spsc_trace_read_to(struct spsc_queue *q, struct spsc_trace_histogram *h, void *dst, size_t size)
+{
+  memcpy(dst, spsc_trace_read(q, h, size), size);
+  spsc_trace_read_commit(q, size);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+# include <immintrin.h>
+# include <x86intrin.h>
+# define SPSC_UMWAIT_X86 1
+#endif
+
+// Low-power waiting with UMONITOR/UMWAIT.
+//
+// spsc_queue_read_umwait() and spsc_queue_write_umwait() arm the monitor
+// on the header cache line holding the peer's offset and sleep in umwait
+// until the line is written or a TSC deadline passes. The peer's commit
+// ends the wait without any syscall, and the core stays in a light C0.x
+// state in the meantime instead of spinning. Waiting is bounded by cycles
+// TSC ticks, after which both fall back to the futex. The kernel also
+// limits a single umwait, in /sys/devices/system/cpu/umwait_control, so
+// the wait is re-armed until the deadline.
+//
+// WAITPKG support is detected at runtime. Without it the wait spins with
+// pause until the deadline instead. Like a spinning reader, a reader in
+// umwait has not announced itself in read_size, so the writer does not
+// issue a futex wake for it.
+
+#define SPSC_UMWAIT_DEFAULT_CYCLES 100000
+
+enum spsc_umwait_state
+{
+  // Deeper C0.2 sleep, slower to wake.
+  SPSC_UMWAIT_C02 = 0,
+  // Lighter C0.1 sleep, faster to wake.
+  SPSC_UMWAIT_C01 = 1,
+};
+
+#ifdef SPSC_UMWAIT_X86
+__attribute__((target("waitpkg")))
+static inline void spsc_umwait_arm(const void *addr)
+{
+  _umonitor((void*)addr);
+}
+
+__attribute__((target("waitpkg")))
+static inline void spsc_umwait_sleep(uint64_t deadline, unsigned int state)
+{
+  _umwait(state, deadline);
+}
+#endif
+
+// Returns non-zero if the CPU supports UMONITOR/UMWAIT.
+static inline int spsc_umwait_supported()
+{
+#ifdef SPSC_UMWAIT_X86
+  static int supported = -1;
+
+  if (unlikely(supported < 0))
+  {
+    unsigned int eax, ebx, ecx, edx;
+
+    supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 5)) ? 1 : 0;
+  }
+
+  return supported;
+#else
+  return 0;
+#endif
+}
+
+// Waits until *word differs from value or the deadline passes. Returns 0
+// once the deadline has passed.
+static inline int spsc_umwait_until(SQ_ATOMIC(uint32_t) *word, uint32_t value, uint64_t *deadline,
+                                    unsigned int state)
+{
+#ifdef SPSC_UMWAIT_X86
+  if (spsc_umwait_supported())
+  {
+    spsc_umwait_arm((const void*)word);
+
+    // A write between the caller's check and arming the monitor would not
+    // end the wait.
+    if (sq_read_once(*word) != value)
+      return 1;
+
+    spsc_umwait_sleep(*deadline, state);
+  }
+  else
+  {
+    sq_cpu_relax();
+  }
+
+  return __rdtsc() < *deadline;
+#else
+  (void)word;
+  (void)value;
+  (void)state;
+  sq_cpu_relax();
+  // Without a TSC the deadline counts polls.
+  return (*deadline)-- > 0;
+#endif
+}
+
+static inline uint64_t spsc_umwait_deadline(uint64_t cycles)
+{
+#ifdef SPSC_UMWAIT_X86
+  return __rdtsc() + cycles;
+#else
+  return cycles;
+#endif
+}
+
+// Like spsc_queue_read() but waits in umwait for up to cycles TSC ticks
+// before waiting on the futex.
+static inline const void *spsc_queue_read_umwait(struct spsc_queue *q, size_t size, uint64_t cycles,
+                                                 unsigned int state)
+{
+  uint64_t deadline = spsc_umwait_deadline(cycles);
+
+  while (1)
+  {
+    uint32_t write_offset = sq_read_once(q->header->write_offset);
+    const void *src = spsc_queue_try_read(q, size);
+
+    if (likely(src != NULL))
+      return src;
+
+    if (!spsc_umwait_until(&q->header->write_offset, write_offset, &deadline, state))
+      return spsc_queue_read(q, size);
+  }
+}
+
+// Like spsc_queue_write() but waits in umwait for up to cycles TSC ticks
+// before waiting on the futex.
+static inline void *spsc_queue_write_umwait(struct spsc_queue *q, size_t size, uint64_t cycles,
+                                            unsigned int state)
+{
+  uint64_t deadline = spsc_umwait_deadline(cycles);
+
+  while (1)
+  {
+    uint32_t read_offset = sq_read_once(q->header->read_offset);
+    void *dst = spsc_queue_try_write(q, size);
+
+    if (likely(dst != NULL))
+      return dst;
+
+    if (!spsc_umwait_until(&q->header->read_offset, read_offset, &deadline, state))
+      return spsc_queue_write(q, size);
+  }
+}
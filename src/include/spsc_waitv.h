@@ -0,0 +1,131 @@
+#pragma once
+
+#include "spsc_queue.h"
+
+#include <time.h>
+
+// Waiting on many queues at once with futex_waitv (Linux 5.16).
+//
+// spsc_queue_read_any() scans the queues for one with at least size bytes
+// to read. If there is none, it stores size in the read_size of every
+// queue, exactly like spsc_queue_read() does for one queue, and sleeps in
+// futex_waitv on all write_offsets. The writers need no change: their
+// commit wakes the write_offset futex as before, which ends the vectored
+// wait. No shared structure besides the queue headers is involved.
+//
+// On kernels without futex_waitv the reader waits on one queue at a time
+// with a timeout of SPSC_WAITV_POLL_NS, moving on to the next queue after
+// each timeout. A commit to the queue it waits on still wakes it at once;
+// a commit to any other queue is seen within one timeout.
+
+#define SPSC_WAITV_MAX      128
+#define SPSC_WAITV_POLL_NS  (100 * 1000)
+
+#if defined(SYS_futex_waitv) && defined(FUTEX_WAITV_MAX)
+# define SPSC_WAITV_SYSCALL 1
+#endif
+
+// Returns non-zero if the kernel supports futex_waitv.
+static inline int spsc_waitv_supported()
+{
+#ifdef SPSC_WAITV_SYSCALL
+  static int supported = -1;
+
+  if (unlikely(supported < 0))
+  {
+    // An empty vector fails with EINVAL if the call exists.
+    supported = syscall(SYS_futex_waitv, NULL, 0, 0, NULL, 0) == -1 && errno == ENOSYS ? 0 : 1;
+  }
+
+  return supported;
+#else
+  return 0;
+#endif
+}
+
+// Stores the indexes of the queues with at least size bytes to read in
+// ready, in ascending order, and returns their number. Does not wait.
+static inline unsigned int spsc_queue_try_read_any(struct spsc_queue **queues, unsigned int count, size_t size,
+                                                   unsigned int *ready)
+{
+  unsigned int n = 0;
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    if (spsc_queue_read_size(queues[i]) >= size)
+      ready[n++] = i;
+  }
+
+  if (n)
+    sq_thread_fence_acquire();
+
+  return n;
+}
+
+static inline void spsc_waitv_poll(struct spsc_queue *q, uint32_t write_offset)
+{
+  struct timespec timeout = { 0, SPSC_WAITV_POLL_NS };
+
+  futex((int*)&q->header->write_offset, FUTEX_WAIT, (int)write_offset, &timeout, NULL, 0);
+}
+
+// Like spsc_queue_try_read_any() but waits until at least one of the
+// queues has size bytes to read.
+static inline unsigned int spsc_queue_read_any(struct spsc_queue **queues, unsigned int count, size_t size,
+                                               unsigned int *ready)
+{
+  uint32_t write_offsets[SPSC_WAITV_MAX];
+#ifdef SPSC_WAITV_SYSCALL
+  struct futex_waitv waiters[SPSC_WAITV_MAX];
+#endif
+  unsigned int next = 0;
+
+  assert(count && count <= SPSC_WAITV_MAX);
+
+  while (1)
+  {
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+      struct spsc_header *header = queues[i]->header;
+
+      write_offsets[i] = sq_read_once(header->write_offset);
+
+      if (write_offsets[i] - sq_read_once(header->read_offset) >= size)
+        ready[n++] = i;
+    }
+
+    if (likely(n))
+    {
+      sq_thread_fence_acquire();
+      return n;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+      sq_store_once(queues[i]->header->read_size, size);
+
+    if (!spsc_waitv_supported())
+    {
+      spsc_waitv_poll(queues[next], write_offsets[next]);
+      next = (next + 1) % count;
+      continue;
+    }
+
+#ifdef SPSC_WAITV_SYSCALL
+    for (unsigned int i = 0; i < count; i++)
+    {
+      waiters[i].val = write_offsets[i];
+      waiters[i].uaddr = (uint64_t)(uintptr_t)&queues[i]->header->write_offset;
+      waiters[i].flags = FUTEX_32;
+      waiters[i].__reserved = 0;
+    }
+
+    int status = syscall(SYS_futex_waitv, waiters, count, 0, NULL, 0);
+
+    (void)status;
+
+    assert(-1 != status || errno == EAGAIN || errno == EINTR);
+#endif
+  }
+}
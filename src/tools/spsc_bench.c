@@ -0,0 +1,858 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs benchmarks repeatedly and compares the results with a baseline.
+//
+// Every benchmark is run warm-up times first, then the benchmarks are run
+// repeats times in turn, each pinned to the given CPUs, or by default to
+// the first two CPUs it may run on, one for each side of the benchmarked
+// queues. Pinning keeps the placement of the threads from changing
+// between runs, which would otherwise dominate the variance. Measurements are
+// taken from the output: every number followed by a time unit (ns, us, ms,
+// s) or a rate (GB/s, M events/s, ...) is one sample of a metric. The
+// metric is named after the text before it on its line, the label
+// directly before it and the unit. Lines without measurements name a
+// section for the lines that follow, except progress lines ending in
+// "done.". Numbers with a fraction are replaced by # in names. Numbers
+// following a percentage in their label are not measurements.
+//
+// The results are written as JSON, with all samples. Given a baseline in
+// the same format, each metric is compared with Welch's t-test. A metric
+// is flagged as a regression if it got worse by at least the threshold
+// and the difference is significant at the 95% level. A metric of the
+// baseline which the run did not produce counts as a regression too. The
+// exit status is 1 if any metric regressed, and 2 if the baseline cannot
+// be read, which is checked before anything runs. Without -b nothing is
+// compared.
+
+#define MAX_METRICS   1024
+#define MAX_SAMPLES   64
+#define MAX_NAME      256
+#define MAX_UNIT      32
+#define MAX_LINE      4096
+#define MAX_PROGRAMS  64
+
+struct metric
+{
+  char name[MAX_NAME];
+  char unit[MAX_UNIT];
+  size_t count;
+  double samples[MAX_SAMPLES];
+};
+
+struct metric_set
+{
+  size_t count;
+  struct metric metrics[MAX_METRICS];
+};
+
+struct stats
+{
+  double mean;
+  double stddev;
+  double ci95;
+};
+
+// Names seen in the current run, to number repeated names.
+struct run_names
+{
+  size_t count;
+  char names[MAX_METRICS][MAX_NAME];
+  unsigned int seen[MAX_METRICS];
+};
+
+static void usage()
+{
+  fprintf(stderr,
+          "Usage: spsc_bench [-r REPEATS] [-w WARMUP] [-c CPUS] [-t PERCENT] [-o RESULTS] [-b BASELINE]\n"
+          "                  PROGRAM...\n"
+          "\n"
+          "Runs each PROGRAM WARMUP times (default 1), then REPEATS times (default 5),\n"
+          "pinned to the CPU list CPUS, e.g. 0-1,4 (default: the first two CPUs allowed).\n"
+          "Writes the results as JSON to RESULTS and compares them with BASELINE, flagging\n"
+          "metrics which got significantly worse by at least PERCENT (default 5), or which\n"
+          "are missing. A BASELINE which cannot be read is an error; leave out -b to only\n"
+          "report.\n");
+}
+
+static int higher_is_better(const char *unit)
+{
+  size_t len = strlen(unit);
+
+  return len >= 2 && !strcmp(unit + len - 2, "/s");
+}
+
+static struct metric *find_metric(struct metric_set *set, const char *name)
+{
+  for (size_t i = 0; i < set->count; i++)
+  {
+    if (!strcmp(set->metrics[i].name, name))
+      return &set->metrics[i];
+  }
+
+  return NULL;
+}
+
+static void add_sample(struct metric_set *set, const char *name, const char *unit, double value)
+{
+  struct metric *m = find_metric(set, name);
+
+  if (!m)
+  {
+    if (set->count == MAX_METRICS)
+      return;
+
+    m = &set->metrics[set->count++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    snprintf(m->unit, sizeof(m->unit), "%s", unit);
+    m->count = 0;
+  }
+
+  if (m->count < MAX_SAMPLES)
+    m->samples[m->count++] = value;
+}
+
+static void trim(char *s)
+{
+  size_t len = strlen(s);
+  size_t start = 0;
+
+  while (len && (isspace((unsigned char)s[len - 1]) || s[len - 1] == ':' || s[len - 1] == ','))
+    s[--len] = 0;
+
+  while (isspace((unsigned char)s[start]))
+    start++;
+
+  memmove(s, s + start, len - start + 1);
+}
+
+// Copies len bytes of src to dst, replacing numbers with a fraction by #.
+static void copy_name(char *dst, size_t size, const char *src, size_t len)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < len && n + 1 < size;)
+  {
+    size_t j = i;
+
+    while (j < len && isdigit((unsigned char)src[j]))
+      j++;
+
+    if (j > i && j + 1 < len && src[j] == '.' && isdigit((unsigned char)src[j + 1]))
+    {
+      j++;
+      while (j < len && isdigit((unsigned char)src[j]))
+        j++;
+
+      dst[n++] = '#';
+      i = j;
+      continue;
+    }
+
+    if (j == i)
+      j++;
+
+    while (i < j && n + 1 < size)
+      dst[n++] = src[i++];
+  }
+
+  dst[n] = 0;
+  trim(dst);
+}
+
+// Reads the unit after a number at *p. Returns 0 if it is not a unit of
+// a measurement.
+static int parse_unit(const char *p, char *unit, size_t size)
+{
+  static const char *times[] = { "ns", "us", "ms", "s" };
+  char token[MAX_UNIT];
+  size_t len = 0;
+
+  if (*p != ' ')
+    return 0;
+
+  while (*p == ' ')
+    p++;
+
+  while (p[len] && !isspace((unsigned char)p[len]) && p[len] != ',' && p[len] != ')' && len + 1 < sizeof(token))
+    len++;
+
+  memcpy(token, p, len);
+  token[len] = 0;
+
+  while (len && (token[len - 1] == ':' || token[len - 1] == '.'))
+    token[--len] = 0;
+
+  for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++)
+  {
+    if (!strcmp(token, times[i]))
+    {
+      snprintf(unit, size, "%s", token);
+      return 1;
+    }
+  }
+
+  if (higher_is_better(token))
+  {
+    snprintf(unit, size, "%s", token);
+    return 1;
+  }
+
+  // A multiplier in a word of its own, as in "M events/s".
+  if (len == 1 && strchr("KMG", token[0]))
+  {
+    char next[MAX_UNIT - 2];
+
+    if (parse_unit(p + 1, next, sizeof(next)) && higher_is_better(next))
+    {
+      snprintf(unit, size, "%c %s", token[0], next);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Position of the first ": " in s before end, or NULL.
+static const char *find_colon(const char *s, const char *end)
+{
+  for (const char *p = s; p + 1 < end; p++)
+  {
+    // Skip "::" in C++ names.
+    if (p[0] == ':' && p[1] == ' ' && (p == s || p[-1] != ':'))
+      return p;
+  }
+
+  return NULL;
+}
+
+// Copies the label of the number at start to label: the text before it,
+// back to the previous ": " or ", ". A number right after a comma has no
+// label.
+static void find_label(const char *line, const char *start, char *label, size_t size)
+{
+  const char *end = start;
+  const char *begin = line;
+
+  while (end > line && end[-1] == ' ')
+    end--;
+
+  if (end > line && end[-1] == ',')
+    end = line;
+  else if (end > line && end[-1] == ':')
+    end--;
+
+  for (const char *p = line; p + 1 < end; p++)
+  {
+    if ((p[0] == ':' || p[0] == ',') && p[1] == ' ' && (p == line || p[-1] != ':'))
+      begin = p + 2;
+  }
+
+  copy_name(label, size, begin, end > begin ? (size_t)(end - begin) : 0);
+}
+
+static void parse_line(const char *program, char *section, const char *line, struct metric_set *set,
+                       struct run_names *names)
+{
+  struct
+  {
+    const char *start;
+    double value;
+    char unit[MAX_UNIT];
+  } found[64];
+  size_t count = 0;
+  size_t len = strlen(line);
+
+  for (const char *p = line; *p && count < 64;)
+  {
+    char *end;
+
+    if (!isdigit((unsigned char)*p) || (p > line && (isalnum((unsigned char)p[-1]) || p[-1] == '.' ||
+                                                     p[-1] == '_')))
+    {
+      p++;
+      continue;
+    }
+
+    found[count].value = strtod(p, &end);
+    found[count].start = p;
+
+    if (end > p && parse_unit(end, found[count].unit, sizeof(found[count].unit)))
+      count++;
+
+    p = end > p ? end : p + 1;
+  }
+
+  if (!count)
+  {
+    if (len && !(len >= 5 && !strcmp(line + len - 5, "done.")))
+    {
+      size_t n;
+
+      copy_name(section, MAX_NAME, line, len);
+      n = strlen(section);
+
+      if (n && section[n - 1] == '.')
+        section[n - 1] = 0;
+    }
+    return;
+  }
+
+  char labels[64][MAX_NAME];
+  int labelled = 1;
+  size_t kept = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    find_label(line, found[i].start, labels[kept], MAX_NAME);
+
+    // A number after a percentage, as in "1.4% of 2.0 s", is what the
+    // percentage refers to rather than a measurement. A label ending in
+    // one, as in "99%: 10 ns", is fine.
+    const char *percent = strchr(labels[kept], '%');
+
+    if (percent && percent[1])
+      continue;
+
+    found[kept] = found[i];
+    labelled &= labels[kept][0] != 0;
+    kept++;
+  }
+
+  count = kept;
+
+  if (!count)
+    return;
+
+  // The scenario is the text before the first colon, if that comes
+  // before the first measurement, or else all text before it.
+  char scenario[MAX_NAME];
+  const char *first = find_colon(line, found[0].start);
+
+  copy_name(scenario, sizeof(scenario), line, first ? (size_t)(first - line) : (size_t)(found[0].start - line));
+
+  // Lines like "min: 10 ns, max: 20 ns" have no scenario of their own.
+  if (labelled && !strcmp(labels[0], scenario))
+    scenario[0] = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    char *label = labels[i];
+    char name[MAX_NAME];
+    size_t n = 0;
+    size_t label_len = strlen(label), scenario_len = strlen(scenario);
+
+    if (label_len <= scenario_len && !strcmp(scenario + scenario_len - label_len, label))
+      label[0] = 0;
+
+    n += snprintf(name + n, sizeof(name) - n, "%s", program);
+    if (section[0])
+      n += snprintf(name + n, sizeof(name) - n, " / %s", section);
+    if (scenario[0])
+      n += snprintf(name + n, sizeof(name) - n, " / %s", scenario);
+    if (label[0])
+      n += snprintf(name + n, sizeof(name) - n, " / %s", label);
+    n += snprintf(name + n, sizeof(name) - n, " [%s]", found[i].unit);
+
+    // Number names which occur more than once in a run.
+    size_t k;
+
+    for (k = 0; k < names->count && strcmp(names->names[k], name); k++);
+
+    if (k == names->count && k < MAX_METRICS)
+    {
+      snprintf(names->names[k], MAX_NAME, "%s", name);
+      names->seen[k] = 0;
+      names->count++;
+    }
+
+    if (k < MAX_METRICS && ++names->seen[k] > 1)
+      snprintf(name + n, sizeof(name) - n, " #%u", names->seen[k]);
+
+    add_sample(set, name, found[i].unit, found[i].value);
+  }
+}
+
+static int parse_cpus(const char *list, cpu_set_t *cpus)
+{
+  const char *p = list;
+
+  CPU_ZERO(cpus);
+
+  while (*p)
+  {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+
+    if (end == p || first < 0)
+      return -1;
+
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+
+      if (end == p || last < first)
+        return -1;
+    }
+
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, cpus);
+
+    p = *end == ',' ? end + 1 : end;
+
+    if (*end && *end != ',')
+      return -1;
+  }
+
+  return 0;
+}
+
+// Picks the first two CPUs of the current affinity, or the only one, and
+// writes them as a list to list.
+static int default_cpus(cpu_set_t *cpus, char *list, size_t size)
+{
+  cpu_set_t allowed;
+  int n = 0;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed))
+    return -1;
+
+  CPU_ZERO(cpus);
+  list[0] = 0;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE && n < 2; cpu++)
+  {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+
+    CPU_SET(cpu, cpus);
+    snprintf(list + strlen(list), size - strlen(list), "%s%d", n++ ? "," : "", cpu);
+  }
+
+  return n ? 0 : -1;
+}
+
+// Runs the program and parses its output into set, unless set is NULL.
+static int run_program(const char *path, const cpu_set_t *cpus, struct metric_set *set)
+{
+  static struct run_names names;
+  const char *program = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  char section[MAX_NAME] = "";
+  char line[MAX_LINE];
+  int fds[2];
+  int status;
+  pid_t pid;
+  FILE *f;
+
+  if (pipe(fds))
+    return -1;
+
+  pid = fork();
+
+  if (pid < 0)
+    return -1;
+
+  if (!pid)
+  {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus))
+      _exit(126);
+
+    execl(path, path, (char*)NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+  names.count = 0;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    line[strcspn(line, "\n")] = 0;
+
+    if (set)
+      parse_line(program, section, line, set, &names);
+  }
+
+  fclose(f);
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+  {
+    fprintf(stderr, "%s failed\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Two-sided 95% quantile of Student's t distribution.
+static double t_critical(double df)
+{
+  static const double t95[] = {
+    12.706, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+  };
+
+  // Rounding down is conservative.
+  return df < 31 ? t95[(int)df] : 1.96;
+}
+
+static struct stats compute_stats(const struct metric *m)
+{
+  struct stats s = { 0, 0, 0 };
+
+  for (size_t i = 0; i < m->count; i++)
+    s.mean += m->samples[i];
+
+  s.mean /= m->count;
+
+  if (m->count < 2)
+    return s;
+
+  for (size_t i = 0; i < m->count; i++)
+    s.stddev += (m->samples[i] - s.mean) * (m->samples[i] - s.mean);
+
+  s.stddev = sqrt(s.stddev / (m->count - 1));
+  s.ci95 = t_critical(m->count - 1) * s.stddev / sqrt((double)m->count);
+
+  return s;
+}
+
+// Returns non-zero if the means differ significantly.
+static int significant(const struct metric *a, const struct stats *sa, const struct metric *b,
+                       const struct stats *sb)
+{
+  if (a->count < 2 || b->count < 2)
+    return 0;
+
+  double va = sa->stddev * sa->stddev / a->count;
+  double vb = sb->stddev * sb->stddev / b->count;
+  double se = sqrt(va + vb);
+
+  if (se == 0)
+    return sa->mean != sb->mean;
+
+  double t = fabs(sa->mean - sb->mean) / se;
+  double df = (va + vb) * (va + vb) / (va * va / (a->count - 1) + vb * vb / (b->count - 1));
+
+  return t > t_critical(df);
+}
+
+static void write_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(f, "\\u%04x", *s);
+    else
+      fputc(*s, f);
+  }
+
+  fputc('"', f);
+}
+
+static int write_results(const char *path, const struct metric_set *set, unsigned int repeats,
+                         unsigned int warmup, const char *cpus)
+{
+  FILE *f = fopen(path, "w");
+
+  if (!f)
+    return -1;
+
+  fprintf(f, "{\n  \"repeats\": %u,\n  \"warmup\": %u,\n  \"cpus\": ", repeats, warmup);
+  write_string(f, cpus ? cpus : "");
+  fprintf(f, ",\n  \"results\": [\n");
+
+  for (size_t i = 0; i < set->count; i++)
+  {
+    const struct metric *m = &set->metrics[i];
+    struct stats s = compute_stats(m);
+
+    fprintf(f, "    {\"name\": ");
+    write_string(f, m->name);
+    fprintf(f, ", \"unit\": ");
+    write_string(f, m->unit);
+    fprintf(f, ", \"higher_is_better\": %s, \"mean\": %.17g, \"stddev\": %.17g, \"ci95\": %.17g, \"samples\": [",
+            higher_is_better(m->unit) ? "true" : "false", s.mean, s.stddev, s.ci95);
+
+    for (size_t j = 0; j < m->count; j++)
+      fprintf(f, "%s%.17g", j ? ", " : "", m->samples[j]);
+
+    fprintf(f, "]}%s\n", i + 1 < set->count ? "," : "");
+  }
+
+  fprintf(f, "  ]\n}\n");
+
+  return fclose(f) ? -1 : 0;
+}
+
+// Reads the string value of key after *p into dst. Returns 0 on success.
+static int read_string(const char **p, const char *key, char *dst, size_t size)
+{
+  const char *s = strstr(*p, key);
+  size_t n = 0;
+
+  if (!s)
+    return -1;
+
+  s = strchr(s + strlen(key), '"');
+
+  if (!s)
+    return -1;
+
+  for (s++; *s && *s != '"'; s++)
+  {
+    char c = *s;
+
+    if (c == '\\' && s[1])
+    {
+      c = *++s;
+
+      if (c == 'u')
+      {
+        c = (char)strtol(s + 1, NULL, 16);
+        s += 4;
+      }
+    }
+
+    if (n + 1 < size)
+      dst[n++] = c;
+  }
+
+  dst[n] = 0;
+  *p = *s ? s + 1 : s;
+
+  return 0;
+}
+
+// Reads results written by write_results().
+static int read_results(const char *path, struct metric_set *set)
+{
+  FILE *f = fopen(path, "r");
+  char *data;
+  long size;
+
+  if (!f)
+    return -1;
+
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  rewind(f);
+  data = malloc(size + 1);
+
+  if (!data || fread(data, 1, size, f) != (size_t)size)
+  {
+    free(data);
+    fclose(f);
+    return -1;
+  }
+
+  data[size] = 0;
+  fclose(f);
+
+  const char *p = data;
+  char name[MAX_NAME], unit[MAX_UNIT];
+
+  while (!read_string(&p, "\"name\":", name, sizeof(name)) && !read_string(&p, "\"unit\":", unit, sizeof(unit)))
+  {
+    const char *s = strstr(p, "\"samples\":");
+
+    if (!s || !(s = strchr(s, '[')))
+      break;
+
+    for (s++; *s && *s != ']';)
+    {
+      char *end;
+      double value = strtod(s, &end);
+
+      if (end == s)
+      {
+        s++;
+        continue;
+      }
+
+      add_sample(set, name, unit, value);
+      s = end;
+    }
+
+    p = s;
+  }
+
+  free(data);
+
+  return 0;
+}
+
+// Prints the results and returns the number of regressions, including
+// metrics of the baseline which are missing from the results.
+static unsigned int report(struct metric_set *set, struct metric_set *baseline, double threshold)
+{
+  unsigned int regressions = 0;
+
+  printf("%-72s %14s %12s %14s %8s\n", "metric", "mean", "+/- 95%", "baseline", "change");
+
+  for (size_t i = 0; i < set->count; i++)
+  {
+    const struct metric *m = &set->metrics[i];
+    const struct metric *b = baseline ? find_metric(baseline, m->name) : NULL;
+    struct stats s = compute_stats(m);
+
+    printf("%-72s %14.6g %12.3g", m->name, s.mean, s.ci95);
+
+    if (!b || !b->count)
+    {
+      printf("\n");
+      continue;
+    }
+
+    struct stats sb = compute_stats(b);
+    double change = sb.mean ? (s.mean - sb.mean) / sb.mean : 0;
+    int worse = higher_is_better(m->unit) ? change < 0 : change > 0;
+    const char *verdict = "";
+
+    if (significant(m, &s, b, &sb) && fabs(change) >= threshold)
+    {
+      verdict = worse ? "REGRESSION" : "improved";
+      regressions += worse;
+    }
+
+    printf(" %14.6g %+7.1f%% %s\n", sb.mean, 100 * change, verdict);
+  }
+
+  for (size_t i = 0; baseline && i < baseline->count; i++)
+  {
+    const struct metric *b = &baseline->metrics[i];
+
+    if (find_metric(set, b->name))
+      continue;
+
+    printf("%-72s %14s %12s %14.6g %8s MISSING\n", b->name, "-", "-", compute_stats(b).mean, "");
+    regressions++;
+  }
+
+  return regressions;
+}
+
+int main(int argc, char **argv)
+{
+  static struct metric_set results, baseline;
+  unsigned int repeats = 5, warmup = 1;
+  const char *output = NULL, *baseline_path = NULL, *cpu_list = NULL;
+  double threshold = 0.05;
+  char default_list[32];
+  cpu_set_t cpus;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:w:c:t:o:b:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      repeats = (unsigned int)atoi(optarg);
+      break;
+    case 'w':
+      warmup = (unsigned int)atoi(optarg);
+      break;
+    case 'c':
+      cpu_list = optarg;
+      break;
+    case 't':
+      threshold = atof(optarg) / 100;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    default:
+      usage();
+      return 2;
+    }
+  }
+
+  if (optind == argc || !repeats || repeats > MAX_SAMPLES || argc - optind > MAX_PROGRAMS)
+  {
+    usage();
+    return 2;
+  }
+
+  if (cpu_list && parse_cpus(cpu_list, &cpus))
+  {
+    fprintf(stderr, "Invalid CPU list: %s\n", cpu_list);
+    return 2;
+  }
+
+  if (!cpu_list)
+  {
+    if (default_cpus(&cpus, default_list, sizeof(default_list)))
+    {
+      fprintf(stderr, "Reading the CPU affinity failed: %s\n", strerror(errno));
+      return 2;
+    }
+
+    cpu_list = default_list;
+  }
+
+  if (baseline_path && read_results(baseline_path, &baseline))
+  {
+    fprintf(stderr, "Reading baseline %s failed: %s\n", baseline_path, strerror(errno));
+    return 2;
+  }
+
+  for (int i = optind; i < argc; i++)
+  {
+    for (unsigned int j = 0; j < warmup; j++)
+    {
+      fprintf(stderr, "%s: warm-up %u/%u\n", argv[i], j + 1, warmup);
+
+      if (run_program(argv[i], &cpus, NULL))
+        return 1;
+    }
+  }
+
+  // Runs alternate between programs, so slow drift affects all of them.
+  for (unsigned int j = 0; j < repeats; j++)
+  {
+    for (int i = optind; i < argc; i++)
+    {
+      fprintf(stderr, "%s: run %u/%u\n", argv[i], j + 1, repeats);
+
+      if (run_program(argv[i], &cpus, &results))
+        return 1;
+    }
+  }
+
+  if (output && write_results(output, &results, repeats, warmup, cpu_list))
+  {
+    fprintf(stderr, "Writing %s failed: %s\n", output, strerror(errno));
+    return 1;
+  }
+
+  unsigned int regressions = report(&results, baseline_path ? &baseline : NULL, threshold);
+
+  if (regressions)
+    printf("%u regression%s.\n", regressions, regressions > 1 ? "s" : "");
+
+  return regressions ? 1 : 0;
+}
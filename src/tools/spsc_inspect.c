@@ -0,0 +1,377 @@
+#include <spsc_queue.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Inspects named queues, as created by fork_named_bandwidth, without
+// taking part in them. Queues are mapped read-only, so neither side can be
+// disturbed.
+
+#define SHM_DIR         "/dev/shm"
+#define MAX_QUEUES      1024
+
+struct snapshot
+{
+  uint32_t write_offset;
+  uint32_t read_offset;
+  size_t write_size;
+  size_t read_size;
+  double time;
+};
+
+struct queue_info
+{
+  char name[NAME_MAX + 1];
+  struct spsc_queue q;
+  struct snapshot last;
+};
+
+static double now_seconds()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec * 1E-9;
+}
+
+static void usage()
+{
+  fprintf(stderr,
+          "Usage: spsc_inspect stat NAME\n"
+          "       spsc_inspect rate NAME [INTERVAL_MS]\n"
+          "       spsc_inspect dump NAME [BYTES]\n"
+          "       spsc_inspect tail NAME [BYTES]\n"
+          "       spsc_inspect top [INTERVAL_MS] [ITERATIONS]\n"
+          "\n"
+          "NAME is the name of a shared memory object in " SHM_DIR ".\n");
+}
+
+// Maps the named queue read-only. Returns 0 on success, with errno set
+// otherwise.
+static int open_queue(struct spsc_queue *q, const char *name)
+{
+  struct stat statbuf;
+  size_t page_size = (size_t)getpagesize();
+  int fd = shm_open(name, O_RDONLY, 0);
+  int status = -1;
+
+  if (fd < 0)
+    return -1;
+
+  spsc_queue_init(q);
+
+  do
+  {
+    if (fstat(fd, &statbuf))
+      break;
+
+    size_t size = (size_t)statbuf.st_size;
+
+    // A header page followed by a power of two sized ring.
+    if (size <= page_size || ((size - page_size) & (size - page_size - 1)))
+    {
+      errno = EINVAL;
+      break;
+    }
+
+    status = spsc_queue_fdopen_flags(q, fd, SPSC_QUEUE_READONLY);
+  }
+  while (0);
+
+  close(fd);
+
+  return status;
+}
+
+static void take_snapshot(const struct spsc_queue *q, struct snapshot *s)
+{
+  s->read_offset = sq_read_once(q->header->read_offset);
+  s->write_offset = sq_read_once(q->header->write_offset);
+  s->read_size = sq_read_once(q->header->read_size);
+  s->write_size = sq_read_once(q->header->write_size);
+  s->time = now_seconds();
+}
+
+static size_t occupancy(const struct snapshot *s)
+{
+  return s->write_offset - s->read_offset;
+}
+
+// The sizes of the last waits are never cleared, so a side is only
+// blocked if its request cannot be satisfied right now.
+static int reader_blocked(const struct snapshot *s)
+{
+  return s->read_size && occupancy(s) < s->read_size;
+}
+
+static int writer_blocked(const struct spsc_queue *q, const struct snapshot *s)
+{
+  return s->write_size && spsc_queue_capacity(q) < occupancy(s) + s->write_size;
+}
+
+static int consistent(const struct spsc_queue *q, const struct snapshot *s)
+{
+  return occupancy(s) <= spsc_queue_capacity(q);
+}
+
+static const char *state(const struct spsc_queue *q, const struct snapshot *before, const struct snapshot *after)
+{
+  int wrote = before && before->write_offset != after->write_offset;
+  int read = before && before->read_offset != after->read_offset;
+
+  if (!consistent(q, after))
+    return "corrupt";
+  if (writer_blocked(q, after))
+    return read ? "saturated" : "writer blocked";
+  if (reader_blocked(after))
+    return "reader waiting";
+  if (before && !read && occupancy(after))
+    return wrote ? "reader stalled" : "stuck";
+  if (!occupancy(after))
+    return "empty";
+
+  return before ? "flowing" : "ok";
+}
+
+static int cmd_stat(const char *name)
+{
+  struct spsc_queue q;
+  struct snapshot s;
+
+  if (open_queue(&q, name))
+  {
+    fprintf(stderr, "Opening %s failed: %s\n", name, strerror(errno));
+    return 1;
+  }
+
+  take_snapshot(&q, &s);
+
+  size_t capacity = spsc_queue_capacity(&q);
+
+  printf("queue:        %s\n", name);
+  printf("capacity:     %zu\n", capacity);
+  printf("occupancy:    %zu (%.1f%%)\n", occupancy(&s), 100.0 * occupancy(&s) / capacity);
+  printf("free:         %zu\n", capacity - occupancy(&s));
+  printf("write_offset: %u (0x%x in ring)\n", s.write_offset, s.write_offset & (uint32_t)(capacity - 1));
+  printf("read_offset:  %u (0x%x in ring)\n", s.read_offset, s.read_offset & (uint32_t)(capacity - 1));
+  printf("write_size:   %zu%s\n", s.write_size, writer_blocked(&q, &s) ? " (writer blocked)" : "");
+  printf("read_size:    %zu%s\n", s.read_size, reader_blocked(&s) ? " (reader waiting)" : "");
+  printf("state:        %s\n", state(&q, NULL, &s));
+
+  spsc_queue_free(&q);
+
+  return 0;
+}
+
+static int cmd_rate(const char *name, unsigned int interval_ms)
+{
+  struct spsc_queue q;
+  struct snapshot before, after;
+
+  if (open_queue(&q, name))
+  {
+    fprintf(stderr, "Opening %s failed: %s\n", name, strerror(errno));
+    return 1;
+  }
+
+  take_snapshot(&q, &before);
+  usleep(interval_ms * 1000);
+  take_snapshot(&q, &after);
+
+  double elapsed = after.time - before.time;
+
+  printf("%s over %.3f s: write %.3f MB/s, read %.3f MB/s, occupancy %zu -> %zu, %s\n", name, elapsed,
+         (uint32_t)(after.write_offset - before.write_offset) / elapsed / 1E6,
+         (uint32_t)(after.read_offset - before.read_offset) / elapsed / 1E6,
+         occupancy(&before), occupancy(&after), state(&q, &before, &after));
+
+  spsc_queue_free(&q);
+
+  return 0;
+}
+
+static void hexdump(const unsigned char *data, size_t size, uint32_t offset)
+{
+  for (size_t i = 0; i < size; i += 16)
+  {
+    size_t n = size - i < 16 ? size - i : 16;
+
+    printf("%08x  ", (uint32_t)(offset + i));
+
+    for (size_t j = 0; j < 16; j++)
+    {
+      if (j < n)
+        printf("%02x ", data[i + j]);
+      else
+        printf("   ");
+      if (j == 7)
+        printf(" ");
+    }
+
+    printf(" |");
+    for (size_t j = 0; j < n; j++)
+      printf("%c", isprint(data[i + j]) ? data[i + j] : '.');
+    printf("|\n");
+  }
+}
+
+// Prints up to bytes of the unread data, from its start or its end. The
+// data is copied out first, so that the dump is not torn by the writer
+// wrapping around while it is printed.
+static int cmd_dump(const char *name, size_t bytes, int tail)
+{
+  struct spsc_queue q;
+  struct snapshot s;
+
+  if (open_queue(&q, name))
+  {
+    fprintf(stderr, "Opening %s failed: %s\n", name, strerror(errno));
+    return 1;
+  }
+
+  take_snapshot(&q, &s);
+
+  if (!consistent(&q, &s))
+  {
+    fprintf(stderr, "%s: inconsistent offsets\n", name);
+    spsc_queue_free(&q);
+    return 1;
+  }
+
+  size_t size = occupancy(&s) < bytes ? occupancy(&s) : bytes;
+  uint32_t start = tail ? s.write_offset - (uint32_t)size : s.read_offset;
+  unsigned char *copy = malloc(size ? size : 1);
+
+  assert(copy);
+
+  memcpy(copy, circular_area_get_pointer(&q.area, start), size);
+  sq_thread_fence_acquire();
+
+  // The reader may have consumed part of it meanwhile.
+  uint32_t read_offset = sq_read_once(q.header->read_offset);
+
+  printf("%s: %zu unread bytes, showing %zu at offset %u\n", name, occupancy(&s), size, start);
+  hexdump(copy, size, start);
+
+  if ((int32_t)(read_offset - start) > 0)
+    printf("(the reader has consumed up to offset %u since)\n", read_offset);
+
+  free(copy);
+  spsc_queue_free(&q);
+
+  return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(((const struct queue_info*)a)->name, ((const struct queue_info*)b)->name);
+}
+
+// Maps every queue in SHM_DIR. Objects which do not look like a queue are
+// skipped.
+static size_t scan(struct queue_info *queues, size_t max)
+{
+  DIR *dir = opendir(SHM_DIR);
+  struct dirent *entry;
+  size_t count = 0;
+
+  if (!dir)
+    return 0;
+
+  while (count < max && (entry = readdir(dir)))
+  {
+    struct queue_info *info = &queues[count];
+
+    if (entry->d_name[0] == '.' || strlen(entry->d_name) > NAME_MAX)
+      continue;
+
+    if (open_queue(&info->q, entry->d_name))
+      continue;
+
+    strcpy(info->name, entry->d_name);
+    take_snapshot(&info->q, &info->last);
+    count++;
+  }
+
+  closedir(dir);
+
+  qsort(queues, count, sizeof(*queues), compare_names);
+
+  return count;
+}
+
+static int cmd_top(unsigned int interval_ms, unsigned int iterations)
+{
+  struct queue_info *queues = calloc(MAX_QUEUES, sizeof(struct queue_info));
+
+  assert(queues);
+
+  for (unsigned int i = 0; !iterations || i < iterations; i++)
+  {
+    size_t count = scan(queues, MAX_QUEUES);
+
+    usleep(interval_ms * 1000);
+
+    if (isatty(STDOUT_FILENO))
+      printf("\033[H\033[J");
+
+    printf("%zu queues in " SHM_DIR ", interval %u ms\n\n", count, interval_ms);
+    printf("%-32s %10s %7s %12s %12s  %s\n", "NAME", "CAPACITY", "USED", "WRITE MB/s", "READ MB/s", "STATE");
+
+    for (size_t j = 0; j < count; j++)
+    {
+      struct queue_info *info = &queues[j];
+      struct snapshot now;
+
+      take_snapshot(&info->q, &now);
+
+      double elapsed = now.time - info->last.time;
+
+      printf("%-32s %10zu %6.1f%% %12.3f %12.3f  %s\n", info->name, spsc_queue_capacity(&info->q),
+             100.0 * occupancy(&now) / spsc_queue_capacity(&info->q),
+             (uint32_t)(now.write_offset - info->last.write_offset) / elapsed / 1E6,
+             (uint32_t)(now.read_offset - info->last.read_offset) / elapsed / 1E6,
+             state(&info->q, &info->last, &now));
+
+      spsc_queue_free(&info->q);
+    }
+
+    fflush(stdout);
+  }
+
+  free(queues);
+
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc >= 2 && !strcmp(argv[1], "top"))
+    return cmd_top(argc > 2 ? (unsigned int)atoi(argv[2]) : 1000, argc > 3 ? (unsigned int)atoi(argv[3]) : 0);
+
+  if (argc < 3)
+  {
+    usage();
+    return 2;
+  }
+
+  if (!strcmp(argv[1], "stat"))
+    return cmd_stat(argv[2]);
+  if (!strcmp(argv[1], "rate"))
+    return cmd_rate(argv[2], argc > 3 ? (unsigned int)atoi(argv[3]) : 1000);
+  if (!strcmp(argv[1], "dump"))
+    return cmd_dump(argv[2], argc > 3 ? (size_t)atol(argv[3]) : 256, 0);
+  if (!strcmp(argv[1], "tail"))
+    return cmd_dump(argv[2], argc > 3 ? (size_t)atol(argv[3]) : 256, 1);
+
+  usage();
+  return 2;
+}